@@ -2,6 +2,7 @@
 #define ARENA_H
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
 
 typedef struct {
@@ -36,6 +37,9 @@ void arena_destroy(Arena *arena) {
 }
 
 void *arena_allocate(Arena *arena, size_t size) {
+    // Keep every allocation aligned like malloc so structs with atomics or 64-bit fields are safe
+    size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+
     assert(arena->position + size <= arena->size);
 
     void *ptr = (void *) (arena->data + arena->position);
@@ -0,0 +1,135 @@
+/*
+
+Check the gradients of the tensor ops against finite differences, including trainable inputs (a learned
+image) and computed inputs (the output of another layer)
+
+*/
+
+#include <stdio.h>
+#include <math.h>
+
+#include "arena.h"
+#include "conv.h"
+#include "micrograd.h"
+
+#define CHECK_SIZE      6
+#define CHECK_CHANNELS  2
+#define EPSILON_FD      1e-2f
+#define TOLERANCE       2e-2f
+
+typedef enum {
+    INPUT_TRAINABLE,    // Parameters fed straight into the op
+    INPUT_COMPUTED      // Parameters passed through a relu first
+} INPUT_KIND;
+
+typedef enum {
+    CHECK_CONV2D,
+    CHECK_MAXPOOL2D,
+    CHECK_AVGPOOL2D
+} CHECK_OP;
+
+float check_loss(Graph *graph) {
+    graph_forward(graph);
+    return graph->values[0]->data;
+}
+
+float check_case(Arena *arena, CHECK_OP op, INPUT_KIND kind) {
+    // Loss = sum of the op's outputs times fixed random coefficients, so every output gradient differs
+    size_t num_inputs = CHECK_CHANNELS * CHECK_SIZE * CHECK_SIZE;
+    Value **leaves = (Value **) arena_allocate(arena, sizeof(Value *) * num_inputs);
+    Value **inputs = (Value **) arena_allocate(arena, sizeof(Value *) * num_inputs);
+
+    // Distinct positive values, shuffled: finite differences never cross a relu kink or a max pooling tie
+    for (size_t i = 0; i < num_inputs; i++) {
+        leaves[i] = value_create_parameter(arena, 0.1f + 0.05f * (float) i);
+    }
+
+    for (size_t i = num_inputs; i > 1; i--) {
+        size_t j = rng_below(rng_thread(), i);
+        Value *swap = leaves[i - 1];
+
+        leaves[i - 1] = leaves[j];
+        leaves[j] = swap;
+    }
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        inputs[i] = kind == INPUT_COMPUTED ? op_relu(arena, leaves[i]) : leaves[i];
+    }
+
+    Tensor input = tensor_create(inputs, CHECK_CHANNELS, CHECK_SIZE, CHECK_SIZE);
+    Tensor output;
+
+    if (op == CHECK_CONV2D) {
+        output = op_conv2d(arena, input, (Conv2dConfig) { .out_channels = 3, .kernel_size = 3, .stride = 1, .padding = 1, .initializer = INIT_XAVIER });
+    }
+    else if (op == CHECK_MAXPOOL2D) {
+        output = op_maxpool2d(arena, input, 2, 2);
+    }
+    else {
+        output = op_avgpool2d(arena, input, 2, 2);
+    }
+
+    size_t num_outputs;
+    Value **flat = op_flatten(output, &num_outputs);
+    Value **terms = (Value **) arena_allocate(arena, sizeof(Value *) * num_outputs);
+
+    for (size_t i = 0; i < num_outputs; i++) {
+        terms[i] = op_mul(arena, flat[i], value_create_constant(arena, 2.0f * rng_uniform(rng_thread()) - 1.0f));
+    }
+
+    Graph *graph = graph_create(arena, _sum_create(arena, terms, num_outputs), 100000);
+
+    graph_zero_grad(graph);
+    graph_forward(graph);
+    graph_backward(graph);
+
+    // Every trainable leaf: the learned inputs, and the convolution's weights and biases
+    float worst = 0;
+
+    for (size_t i = 0; i < graph->num_values; i++) {
+        Value *value = graph->values[i];
+
+        if (value->forward || value->not_trainable) continue;
+
+        float analytic = value->grad;
+        float original = value->data;
+
+        value->data = original + EPSILON_FD;
+        float plus = check_loss(graph);
+        value->data = original - EPSILON_FD;
+        float minus = check_loss(graph);
+        value->data = original;
+
+        float numeric = (plus - minus) / (2 * EPSILON_FD);
+        float error = fabsf(analytic - numeric) / (1.0f + fabsf(numeric));
+
+        worst = error > worst ? error : worst;
+    }
+
+    return worst;
+}
+
+int main(void) {
+    rng_set_seed(42);
+
+    Arena *arena = arena_create(10000000);
+    const char *ops[] = { "conv2d", "maxpool2d", "avgpool2d" };
+    const char *kinds[] = { "trainable", "computed" };
+    bool passed = true;
+
+    printf("===== Tensor op gradients (tolerance %g) =====\n", TOLERANCE);
+
+    for (CHECK_OP op = CHECK_CONV2D; op <= CHECK_AVGPOOL2D; op++) {
+        for (INPUT_KIND kind = INPUT_TRAINABLE; kind <= INPUT_COMPUTED; kind++) {
+            float error = check_case(arena, op, kind);
+
+            printf("%-10s %-10s inputs: max error %.2e %s\n", ops[op], kinds[kind], error, error <= TOLERANCE ? "ok" : "FAILED");
+            passed = passed && error <= TOLERANCE;
+        }
+    }
+
+    printf("===========================\n");
+
+    arena_destroy(arena);
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,500 @@
+#ifndef CONV_H
+#define CONV_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.h"
+#include "kernels.h"
+#include "micrograd.h"
+
+typedef enum {
+    TENSOR_OP_CONV2D,
+    TENSOR_OP_MAXPOOL2D,
+    TENSOR_OP_AVGPOOL2D
+} TENSOR_OP;
+
+// An image-shaped view over scalar values, stored channel by channel, then row by row
+typedef struct {
+    Value   **values;
+    size_t  channels;
+    size_t  height;
+    size_t  width;
+} Tensor;
+
+typedef struct {
+    size_t      out_channels;
+    size_t      kernel_size;
+    size_t      stride;
+    size_t      padding;
+    INITIALIZER initializer;
+} Conv2dConfig;
+
+// A tensor op is one value (the anchor) that computes the whole output on contiguous buffers. Each
+// output element is a small value (a tap) that reads its element in forward and adds its gradient
+// back in backward, so the rest of the graph keeps working on scalars. Taps write disjoint elements of
+// the anchor's output gradient, so they can run backward concurrently. The buffers follow this header
+// in the anchor's state; offsets are in floats from the end of the header.
+typedef struct {
+    TENSOR_OP   op;
+    size_t      in_channels;
+    size_t      in_height;
+    size_t      in_width;
+    size_t      out_channels;
+    size_t      out_height;
+    size_t      out_width;
+    size_t      kernel_size;
+    size_t      stride;
+    size_t      padding;
+    bool        input_grad;     // False when every input is a constant, e.g. the image itself
+
+    size_t      input;
+    size_t      input_gradient;
+    size_t      columns;        // im2col of the input: (in_channels * kernel_size^2) x (out_height * out_width)
+    size_t      column_gradient;
+    size_t      weights;
+    size_t      weight_gradient;
+    size_t      output;
+    size_t      output_gradient;
+    size_t      argmax;         // Max pooling: which input each output came from
+    size_t      num_floats;
+} TensorOpState;
+
+// Header
+
+Tensor tensor_create(Value **values, size_t channels, size_t height, size_t width);
+size_t tensor_size(Tensor tensor);
+Tensor tensor_activate(Arena *arena, Tensor tensor, ACTIVATION activation);
+
+Tensor op_conv2d(Arena *arena, Tensor input, Conv2dConfig config);
+Tensor op_maxpool2d(Arena *arena, Tensor input, size_t kernel_size, size_t stride);
+Tensor op_avgpool2d(Arena *arena, Tensor input, size_t kernel_size, size_t stride);
+Value **op_flatten(Tensor tensor, size_t *num_values);
+
+void op_tensor_forward(Value *self);
+void op_tensor_backward(Value *self);
+void op_tap_forward(Value *self);
+void op_tap_backward(Value *self);
+
+float *_tensor_buffer(TensorOpState *state, size_t offset);
+Tensor _tensor_op_create(Arena *arena, TensorOpState shape, Value **children, size_t num_children);
+Tensor _pool2d_create(Arena *arena, Tensor input, size_t kernel_size, size_t stride, TENSOR_OP op);
+void _im2col(TensorOpState *state, const float *input, float *columns);
+void _col2im(TensorOpState *state, const float *columns, float *input);
+void _conv2d_forward(Value *self, TensorOpState *state);
+void _conv2d_backward(Value *self, TensorOpState *state);
+void _pool2d_forward(TensorOpState *state);
+void _pool2d_backward(TensorOpState *state);
+
+// Implementation
+
+Tensor tensor_create(Value **values, size_t channels, size_t height, size_t width) {
+    return (Tensor) {
+        .values = values,
+        .channels = channels,
+        .height = height,
+        .width = width
+    };
+}
+
+size_t tensor_size(Tensor tensor) {
+    return tensor.channels * tensor.height * tensor.width;
+}
+
+Tensor tensor_activate(Arena *arena, Tensor tensor, ACTIVATION activation) {
+    size_t size = tensor_size(tensor);
+    Value **values = (Value **) arena_allocate(arena, sizeof(Value *) * size);
+
+    for (size_t i = 0; i < size; i++) {
+        values[i] = tensor.values[i];
+
+        if (activation == ACT_RELU) values[i] = op_relu(arena, values[i]);
+        else if (activation == ACT_SIGMOID) values[i] = op_sigmoid(arena, values[i]);
+    }
+
+    return tensor_create(values, tensor.channels, tensor.height, tensor.width);
+}
+
+Value **op_flatten(Tensor tensor, size_t *num_values) {
+    // Tensors are already flat arrays of values in channel, row, column order, so flattening is free
+    // and gradients flow straight through
+    *num_values = tensor_size(tensor);
+
+    return tensor.values;
+}
+
+float *_tensor_buffer(TensorOpState *state, size_t offset) {
+    return (float *) (state + 1) + offset;
+}
+
+Tensor _tensor_op_create(Arena *arena, TensorOpState shape, Value **children, size_t num_children) {
+    size_t num_inputs = shape.in_channels * shape.in_height * shape.in_width;
+    size_t num_outputs = shape.out_channels * shape.out_height * shape.out_width;
+    size_t num_columns = shape.in_channels * shape.kernel_size * shape.kernel_size * shape.out_height * shape.out_width;
+    size_t num_weights = shape.out_channels * shape.in_channels * shape.kernel_size * shape.kernel_size;
+    bool is_conv = shape.op == TENSOR_OP_CONV2D;
+
+    shape.input_grad = false;
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        shape.input_grad = shape.input_grad || !value_is_constant(children[i]);
+    }
+
+    // Lay the buffers out one after another; pooling has no columns or weights, convolution no argmax
+    shape.input = 0;
+    shape.input_gradient = shape.input + num_inputs;
+    shape.columns = shape.input_gradient + num_inputs;
+    shape.column_gradient = shape.columns + (is_conv ? num_columns : 0);
+    shape.weights = shape.column_gradient + (is_conv ? num_columns : 0);
+    shape.weight_gradient = shape.weights + (is_conv ? num_weights : 0);
+    shape.output = shape.weight_gradient + (is_conv ? num_weights : 0);
+    shape.output_gradient = shape.output + num_outputs;
+    shape.argmax = shape.output_gradient + num_outputs;
+    shape.num_floats = shape.argmax + (is_conv ? 0 : num_outputs);
+
+    Value *anchor = (Value *) arena_allocate(arena, sizeof(Value));
+    size_t state_size = sizeof(TensorOpState) + sizeof(float) * shape.num_floats;
+
+    *anchor = (Value) {
+        .repr = shape.op == TENSOR_OP_CONV2D ? 'C' : (shape.op == TENSOR_OP_MAXPOOL2D ? 'M' : 'A'),
+        .num_children = num_children,
+        .children = children,
+        .state = arena_allocate(arena, state_size),
+        .state_size = state_size,
+        .forward = op_tensor_forward,
+        .backward = op_tensor_backward
+    };
+
+    memset(anchor->state, 0, state_size);
+    *(TensorOpState *) anchor->state = shape;
+
+    Value **taps = (Value **) arena_allocate(arena, sizeof(Value *) * num_outputs);
+
+    for (size_t k = 0; k < num_outputs; k++) {
+        Value **tap_children = (Value **) arena_allocate(arena, sizeof(Value *) * 1);
+        Value *tap = (Value *) arena_allocate(arena, sizeof(Value));
+
+        tap_children[0] = anchor;
+
+        *tap = (Value) {
+            .repr = 't',
+            .num_children = 1,
+            .children = tap_children,
+            .state = arena_allocate(arena, sizeof(size_t)),
+            .state_size = sizeof(size_t),
+            .forward = op_tap_forward,
+            .backward = op_tap_backward,
+            .grad_in_state = true
+        };
+
+        *(size_t *) tap->state = k;
+        taps[k] = tap;
+    }
+
+    return tensor_create(taps, shape.out_channels, shape.out_height, shape.out_width);
+}
+
+Tensor op_conv2d(Arena *arena, Tensor input, Conv2dConfig config) {
+    size_t stride = config.stride > 0 ? config.stride : 1;
+
+    assert(input.height + 2 * config.padding >= config.kernel_size);
+    assert(input.width + 2 * config.padding >= config.kernel_size);
+
+    TensorOpState shape = {
+        .op = TENSOR_OP_CONV2D,
+        .in_channels = input.channels,
+        .in_height = input.height,
+        .in_width = input.width,
+        .out_channels = config.out_channels,
+        .out_height = (input.height + 2 * config.padding - config.kernel_size) / stride + 1,
+        .out_width = (input.width + 2 * config.padding - config.kernel_size) / stride + 1,
+        .kernel_size = config.kernel_size,
+        .stride = stride,
+        .padding = config.padding
+    };
+
+    // Children are [inputs..., weights (out_channels x in_channels x kernel x kernel)..., biases...]
+    size_t num_inputs = tensor_size(input);
+    size_t fan_in = input.channels * config.kernel_size * config.kernel_size;
+    size_t num_weights = config.out_channels * fan_in;
+    size_t num_children = num_inputs + num_weights + config.out_channels;
+    Value **children = (Value **) arena_allocate(arena, sizeof(Value *) * num_children);
+    float *weights = (float *) calloc(num_weights + config.out_channels, sizeof(float));
+
+    weights_initialize(weights, num_weights, fan_in, config.out_channels * config.kernel_size * config.kernel_size, config.initializer, rng_thread());
+
+    if (config.initializer == INIT_UNIFORM) {
+        weights_initialize(weights + num_weights, config.out_channels, fan_in, config.out_channels, INIT_UNIFORM, rng_thread());
+    }
+
+    memcpy(children, input.values, sizeof(Value *) * num_inputs);
+
+    for (size_t i = 0; i < num_weights + config.out_channels; i++) {
+        Value *parameter = value_create_parameter(arena, weights[i]);
+
+        parameter->repr = i < num_weights ? 'w' : 'b';
+        children[num_inputs + i] = parameter;
+    }
+
+    free(weights);
+    weights = NULL;
+
+    return _tensor_op_create(arena, shape, children, num_children);
+}
+
+Tensor _pool2d_create(Arena *arena, Tensor input, size_t kernel_size, size_t stride, TENSOR_OP op) {
+    stride = stride > 0 ? stride : kernel_size;
+
+    assert(input.height >= kernel_size && input.width >= kernel_size);
+
+    TensorOpState shape = {
+        .op = op,
+        .in_channels = input.channels,
+        .in_height = input.height,
+        .in_width = input.width,
+        .out_channels = input.channels,
+        .out_height = (input.height - kernel_size) / stride + 1,
+        .out_width = (input.width - kernel_size) / stride + 1,
+        .kernel_size = kernel_size,
+        .stride = stride
+    };
+
+    size_t num_inputs = tensor_size(input);
+    Value **children = (Value **) arena_allocate(arena, sizeof(Value *) * num_inputs);
+
+    memcpy(children, input.values, sizeof(Value *) * num_inputs);
+
+    return _tensor_op_create(arena, shape, children, num_inputs);
+}
+
+Tensor op_maxpool2d(Arena *arena, Tensor input, size_t kernel_size, size_t stride) {
+    return _pool2d_create(arena, input, kernel_size, stride, TENSOR_OP_MAXPOOL2D);
+}
+
+Tensor op_avgpool2d(Arena *arena, Tensor input, size_t kernel_size, size_t stride) {
+    return _pool2d_create(arena, input, kernel_size, stride, TENSOR_OP_AVGPOOL2D);
+}
+
+void _im2col(TensorOpState *state, const float *input, float *columns) {
+    // Row (c, ki, kj) of the columns holds, for every output position, the input it sees through that
+    // kernel tap; positions in the padding read 0
+    size_t k = state->kernel_size;
+    size_t num_positions = state->out_height * state->out_width;
+
+    for (size_t c = 0; c < state->in_channels; c++) {
+        for (size_t ki = 0; ki < k; ki++) {
+            for (size_t kj = 0; kj < k; kj++) {
+                float *row = columns + ((c * k + ki) * k + kj) * num_positions;
+
+                for (size_t oh = 0; oh < state->out_height; oh++) {
+                    long ih = (long) (oh * state->stride + ki) - (long) state->padding;
+
+                    for (size_t ow = 0; ow < state->out_width; ow++) {
+                        long iw = (long) (ow * state->stride + kj) - (long) state->padding;
+                        bool inside = ih >= 0 && ih < (long) state->in_height && iw >= 0 && iw < (long) state->in_width;
+
+                        row[oh * state->out_width + ow] = inside ? input[(c * state->in_height + ih) * state->in_width + iw] : 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void _col2im(TensorOpState *state, const float *columns, float *input) {
+    // The adjoint of _im2col: every column entry is added back to the input it was copied from
+    size_t k = state->kernel_size;
+    size_t num_positions = state->out_height * state->out_width;
+
+    for (size_t c = 0; c < state->in_channels; c++) {
+        for (size_t ki = 0; ki < k; ki++) {
+            for (size_t kj = 0; kj < k; kj++) {
+                const float *row = columns + ((c * k + ki) * k + kj) * num_positions;
+
+                for (size_t oh = 0; oh < state->out_height; oh++) {
+                    long ih = (long) (oh * state->stride + ki) - (long) state->padding;
+
+                    if (ih < 0 || ih >= (long) state->in_height) continue;
+
+                    for (size_t ow = 0; ow < state->out_width; ow++) {
+                        long iw = (long) (ow * state->stride + kj) - (long) state->padding;
+
+                        if (iw >= 0 && iw < (long) state->in_width) {
+                            input[(c * state->in_height + ih) * state->in_width + iw] += row[oh * state->out_width + ow];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void _conv2d_forward(Value *self, TensorOpState *state) {
+    size_t num_inputs = state->in_channels * state->in_height * state->in_width;
+    size_t fan_in = state->in_channels * state->kernel_size * state->kernel_size;
+    size_t num_positions = state->out_height * state->out_width;
+    size_t num_weights = state->out_channels * fan_in;
+    float *weights = _tensor_buffer(state, state->weights);
+    float *output = _tensor_buffer(state, state->output);
+
+    for (size_t i = 0; i < num_weights; i++) {
+        weights[i] = self->children[num_inputs + i]->data;
+    }
+
+    _im2col(state, _tensor_buffer(state, state->input), _tensor_buffer(state, state->columns));
+
+    // Output = bias + weights x columns
+    for (size_t o = 0; o < state->out_channels; o++) {
+        float bias = self->children[num_inputs + num_weights + o]->data;
+
+        for (size_t p = 0; p < num_positions; p++) {
+            output[o * num_positions + p] = bias;
+        }
+    }
+
+    kernels()->gemm(state->out_channels, num_positions, fan_in, weights, fan_in, 1, _tensor_buffer(state, state->columns), output);
+}
+
+void _conv2d_backward(Value *self, TensorOpState *state) {
+    size_t num_inputs = state->in_channels * state->in_height * state->in_width;
+    size_t fan_in = state->in_channels * state->kernel_size * state->kernel_size;
+    size_t num_positions = state->out_height * state->out_width;
+    size_t num_weights = state->out_channels * fan_in;
+    float *output_gradient = _tensor_buffer(state, state->output_gradient);
+    float *weight_gradient = _tensor_buffer(state, state->weight_gradient);
+
+    // Weight gradient = output gradient x columns^T
+    memset(weight_gradient, 0, sizeof(float) * num_weights);
+    kernels_gemm_nt(state->out_channels, fan_in, num_positions, output_gradient, _tensor_buffer(state, state->columns), weight_gradient);
+
+    for (size_t i = 0; i < num_weights; i++) {
+        self->children[num_inputs + i]->grad += weight_gradient[i];
+    }
+
+    for (size_t o = 0; o < state->out_channels; o++) {
+        self->children[num_inputs + num_weights + o]->grad += kernels()->sum(output_gradient + o * num_positions, num_positions);
+    }
+
+    if (!state->input_grad) return;
+
+    // Column gradient = weights^T x output gradient, folded back onto the input
+    float *column_gradient = _tensor_buffer(state, state->column_gradient);
+
+    memset(column_gradient, 0, sizeof(float) * fan_in * num_positions);
+    kernels()->gemm(fan_in, num_positions, state->out_channels, _tensor_buffer(state, state->weights), 1, fan_in, output_gradient, column_gradient);
+    _col2im(state, column_gradient, _tensor_buffer(state, state->input_gradient));
+}
+
+void _pool2d_forward(TensorOpState *state) {
+    float *input = _tensor_buffer(state, state->input);
+    float *output = _tensor_buffer(state, state->output);
+    uint32_t *argmax = (uint32_t *) _tensor_buffer(state, state->argmax);
+    size_t k = state->kernel_size;
+
+    for (size_t c = 0; c < state->out_channels; c++) {
+        for (size_t oh = 0; oh < state->out_height; oh++) {
+            for (size_t ow = 0; ow < state->out_width; ow++) {
+                size_t out_index = (c * state->out_height + oh) * state->out_width + ow;
+                size_t best = (c * state->in_height + oh * state->stride) * state->in_width + ow * state->stride;
+                float sum = 0;
+
+                for (size_t ki = 0; ki < k; ki++) {
+                    for (size_t kj = 0; kj < k; kj++) {
+                        size_t in_index = (c * state->in_height + oh * state->stride + ki) * state->in_width + ow * state->stride + kj;
+
+                        sum += input[in_index];
+                        best = input[in_index] > input[best] ? in_index : best;
+                    }
+                }
+
+                if (state->op == TENSOR_OP_MAXPOOL2D) {
+                    output[out_index] = input[best];
+                    argmax[out_index] = (uint32_t) best;
+                }
+                else {
+                    output[out_index] = sum / (float) (k * k);
+                }
+            }
+        }
+    }
+}
+
+void _pool2d_backward(TensorOpState *state) {
+    if (!state->input_grad) return;
+
+    float *input_gradient = _tensor_buffer(state, state->input_gradient);
+    float *output_gradient = _tensor_buffer(state, state->output_gradient);
+    uint32_t *argmax = (uint32_t *) _tensor_buffer(state, state->argmax);
+    size_t num_outputs = state->out_channels * state->out_height * state->out_width;
+    size_t k = state->kernel_size;
+
+    if (state->op == TENSOR_OP_MAXPOOL2D) {
+        for (size_t i = 0; i < num_outputs; i++) {
+            input_gradient[argmax[i]] += output_gradient[i];
+        }
+
+        return;
+    }
+
+    for (size_t c = 0; c < state->out_channels; c++) {
+        for (size_t oh = 0; oh < state->out_height; oh++) {
+            for (size_t ow = 0; ow < state->out_width; ow++) {
+                float share = output_gradient[(c * state->out_height + oh) * state->out_width + ow] / (float) (k * k);
+
+                for (size_t ki = 0; ki < k; ki++) {
+                    for (size_t kj = 0; kj < k; kj++) {
+                        input_gradient[(c * state->in_height + oh * state->stride + ki) * state->in_width + ow * state->stride + kj] += share;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void op_tensor_forward(Value *self) {
+    TensorOpState *state = (TensorOpState *) self->state;
+    size_t num_inputs = state->in_channels * state->in_height * state->in_width;
+    float *input = _tensor_buffer(state, state->input);
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        input[i] = self->children[i]->data;
+    }
+
+    if (state->op == TENSOR_OP_CONV2D) _conv2d_forward(self, state);
+    else _pool2d_forward(state);
+
+    // The taps accumulate into the output gradient during backward
+    memset(_tensor_buffer(state, state->output_gradient), 0, sizeof(float) * state->out_channels * state->out_height * state->out_width);
+
+    self->data = 0;
+}
+
+void op_tensor_backward(Value *self) {
+    TensorOpState *state = (TensorOpState *) self->state;
+    size_t num_inputs = state->in_channels * state->in_height * state->in_width;
+    float *input_gradient = _tensor_buffer(state, state->input_gradient);
+
+    memset(input_gradient, 0, sizeof(float) * num_inputs);
+
+    if (state->op == TENSOR_OP_CONV2D) _conv2d_backward(self, state);
+    else _pool2d_backward(state);
+
+    if (!state->input_grad) return;
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        if (!value_is_constant(self->children[i])) self->children[i]->grad += input_gradient[i];
+    }
+}
+
+void op_tap_forward(Value *self) {
+    TensorOpState *state = (TensorOpState *) self->children[0]->state;
+    self->data = _tensor_buffer(state, state->output)[*(size_t *) self->state];
+}
+
+void op_tap_backward(Value *self) {
+    TensorOpState *state = (TensorOpState *) self->children[0]->state;
+    _tensor_buffer(state, state->output_gradient)[*(size_t *) self->state] += self->grad;
+}
+
+#endif // CONV_H
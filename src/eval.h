@@ -0,0 +1,294 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "exec.h"
+#include "micrograd.h"
+#include "mnist.h"
+#include "pool.h"
+#include "timing.h"
+
+#define EVAL_MAX_CLASSES        10
+#define EVAL_BATCH_SIZE         64      // Examples per task, decoded into the worker's buffer in one pass
+
+typedef struct {
+    double  loss;
+    size_t  num_correct;
+    size_t  num_examples;
+    size_t  confusion[EVAL_MAX_CLASSES][EVAL_MAX_CLASSES];     // confusion[label][prediction]
+    double  seconds;
+} EvalResult;
+
+// What one worker owns: activations for one example at a time, and one batch of decoded inputs
+typedef struct {
+    ExecContext *ctx;
+    float       *batch;     // EVAL_BATCH_SIZE rows of [pixels, label], in the model's input order
+    EvalResult  result;
+} EvalWorker;
+
+// Every worker runs the same read-only model (exec.h), which reads its parameters from `snapshot`
+// rather than from the graph being trained, so training carries on while an evaluation runs
+typedef struct {
+    ExecModel       *model;
+    Value           **params;       // The trainer's parameters, in the model's order
+    Value           *snapshot;      // Their values when the evaluation started
+    size_t          num_inputs;
+    size_t          num_outputs;
+    size_t          num_classes;
+
+    ThreadPool      *pool;
+    EvalWorker      *workers;
+    MNISTData       *data;
+
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    bool            running;
+    bool            finished;
+    EvalResult      result;
+} Evaluator;
+
+// Header
+
+Evaluator *evaluator_create(Arena *arena, Graph *graph, Value **inputs, size_t num_inputs, Value *label, Value **outputs, size_t num_outputs, size_t num_workers);
+void evaluator_destroy(Evaluator *evaluator);
+void evaluator_snapshot(Evaluator *evaluator);
+EvalResult evaluator_run(Evaluator *evaluator, MNISTData *data);
+bool evaluator_start(Evaluator *evaluator, MNISTData *data);
+bool evaluator_poll(Evaluator *evaluator, EvalResult *result);
+bool evaluator_wait(Evaluator *evaluator, EvalResult *result);
+void eval_result_print(EvalResult *result, size_t num_classes);
+
+void _evaluator_task(void *context, size_t begin, size_t end, size_t worker);
+void *_evaluator_thread(void *arg);
+
+// Implementation
+
+Evaluator *evaluator_create(Arena *arena, Graph *graph, Value **inputs, size_t num_inputs, Value *label, Value **outputs, size_t num_outputs, size_t num_workers) {
+    Evaluator *evaluator = (Evaluator *) arena_allocate(arena, sizeof(Evaluator));
+
+    // The label is the model's last input, so one row of a batch is [pixels, label]
+    Value **model_inputs = (Value **) calloc(num_inputs + 1, sizeof(Value *));
+
+    memcpy(model_inputs, inputs, sizeof(Value *) * num_inputs);
+    model_inputs[num_inputs] = label;
+
+    *evaluator = (Evaluator) {
+        .model = exec_model_create(arena, graph, model_inputs, num_inputs + 1, outputs, num_outputs),
+        .num_inputs = num_inputs,
+        .num_outputs = num_outputs,
+        .num_classes = num_outputs == 1 ? 2 : num_outputs,
+        .pool = pool_create(num_workers)
+    };
+
+    free(model_inputs);
+    model_inputs = NULL;
+
+    assert(evaluator->num_classes <= EVAL_MAX_CLASSES);
+
+    // Point the shared model at a private copy of the parameters
+    ExecModel *model = evaluator->model;
+
+    evaluator->params = (Value **) arena_allocate(arena, sizeof(Value *) * (model->num_params + 1));
+    evaluator->snapshot = (Value *) arena_allocate(arena, sizeof(Value) * (model->num_params + 1));
+
+    for (size_t p = 0; p < model->num_params; p++) {
+        evaluator->params[p] = model->params[p];
+        evaluator->snapshot[p] = (Value) { .data = model->params[p]->data, .repr = 'v' };
+        model->params[p] = &evaluator->snapshot[p];
+    }
+
+    evaluator->workers = (EvalWorker *) arena_allocate(arena, sizeof(EvalWorker) * num_workers);
+
+    for (size_t w = 0; w < num_workers; w++) {
+        evaluator->workers[w] = (EvalWorker) {
+            .ctx = exec_context_create(arena, model),
+            .batch = (float *) arena_allocate(arena, sizeof(float) * EVAL_BATCH_SIZE * (num_inputs + 1))
+        };
+    }
+
+    pthread_mutex_init(&evaluator->lock, NULL);
+
+    return evaluator;
+}
+
+void evaluator_destroy(Evaluator *evaluator) {
+    EvalResult result;
+
+    evaluator_wait(evaluator, &result);
+
+    pool_destroy(evaluator->pool);
+    evaluator->pool = NULL;
+    pthread_mutex_destroy(&evaluator->lock);
+}
+
+void evaluator_snapshot(Evaluator *evaluator) {
+    // The only part that touches the trainer's graph: copy the current parameters once for every worker
+    for (size_t p = 0; p < evaluator->model->num_params; p++) {
+        evaluator->snapshot[p].data = evaluator->params[p]->data;
+    }
+}
+
+void _evaluator_task(void *context, size_t begin, size_t end, size_t worker) {
+    // Each index is a batch of EVAL_BATCH_SIZE examples
+    Evaluator *evaluator = (Evaluator *) context;
+    EvalWorker *eval_worker = &evaluator->workers[worker];
+    EvalResult *result = &eval_worker->result;
+    MNISTData *data = evaluator->data;
+    size_t row_size = evaluator->num_inputs + 1;
+
+    assert(worker < evaluator->pool->num_workers);
+
+    for (size_t b = begin; b < end; b++) {
+        size_t first = b * EVAL_BATCH_SIZE;
+        size_t last = first + EVAL_BATCH_SIZE < data->num_items ? first + EVAL_BATCH_SIZE : data->num_items;
+
+        for (size_t i = first; i < last; i++) {
+            float *row = eval_worker->batch + (i - first) * row_size;
+
+            get_example(data, i, row);
+            row[evaluator->num_inputs] = (float) data->labels[i];
+        }
+
+        for (size_t i = first; i < last; i++) {
+            uint8_t label = data->labels[i];
+            size_t prediction = 0;
+
+            exec_forward(eval_worker->ctx, eval_worker->batch + (i - first) * row_size);
+
+            if (evaluator->num_outputs == 1) {
+                prediction = exec_output(eval_worker->ctx, 0) < 0.5 ? 0 : 1;
+            }
+            else {
+                for (size_t k = 1; k < evaluator->num_outputs; k++) {
+                    if (exec_output(eval_worker->ctx, k) > exec_output(eval_worker->ctx, prediction)) prediction = k;
+                }
+            }
+
+            result->loss += exec_loss(eval_worker->ctx);
+            result->num_correct += prediction == label;
+            result->num_examples += 1;
+
+            if (label < evaluator->num_classes) result->confusion[label][prediction] += 1;
+        }
+    }
+}
+
+EvalResult evaluator_run(Evaluator *evaluator, MNISTData *data) {
+    // Runs on the calling thread's pool; the model must already hold a snapshot
+    size_t num_workers = evaluator->pool->num_workers;
+    size_t num_batches = (data->num_items + EVAL_BATCH_SIZE - 1) / EVAL_BATCH_SIZE;
+    EvalResult result = { };
+
+    assert(data->num_rows * data->num_cols == evaluator->num_inputs);
+
+    for (size_t w = 0; w < num_workers; w++) {
+        memset(&evaluator->workers[w].result, 0, sizeof(EvalResult));
+    }
+
+    evaluator->data = data;
+
+    double start = time_now_seconds();
+
+    pool_parallel_for(evaluator->pool, 0, num_batches, 1, _evaluator_task, evaluator);
+
+    for (size_t w = 0; w < num_workers; w++) {
+        EvalResult *partial = &evaluator->workers[w].result;
+
+        result.loss += partial->loss;
+        result.num_correct += partial->num_correct;
+        result.num_examples += partial->num_examples;
+
+        for (size_t i = 0; i < EVAL_MAX_CLASSES; i++) {
+            for (size_t j = 0; j < EVAL_MAX_CLASSES; j++) {
+                result.confusion[i][j] += partial->confusion[i][j];
+            }
+        }
+    }
+
+    if (result.num_examples > 0) result.loss /= (double) result.num_examples;
+
+    result.seconds = time_now_seconds() - start;
+
+    return result;
+}
+
+void *_evaluator_thread(void *arg) {
+    Evaluator *evaluator = (Evaluator *) arg;
+    EvalResult result = evaluator_run(evaluator, evaluator->data);
+
+    pthread_mutex_lock(&evaluator->lock);
+    evaluator->result = result;
+    evaluator->finished = true;
+    pthread_mutex_unlock(&evaluator->lock);
+
+    return NULL;
+}
+
+bool evaluator_start(Evaluator *evaluator, MNISTData *data) {
+    // Snapshot on the caller's thread, then evaluate in the background; false if one is already running
+    if (evaluator->running) return false;
+
+    evaluator_snapshot(evaluator);
+
+    evaluator->data = data;
+    evaluator->running = true;
+    evaluator->finished = false;
+
+    pthread_create(&evaluator->thread, NULL, _evaluator_thread, evaluator);
+
+    return true;
+}
+
+bool evaluator_poll(Evaluator *evaluator, EvalResult *result) {
+    if (!evaluator->running) return false;
+
+    pthread_mutex_lock(&evaluator->lock);
+    bool finished = evaluator->finished;
+    pthread_mutex_unlock(&evaluator->lock);
+
+    if (!finished) return false;
+
+    pthread_join(evaluator->thread, NULL);
+
+    evaluator->running = false;
+    *result = evaluator->result;
+
+    return true;
+}
+
+bool evaluator_wait(Evaluator *evaluator, EvalResult *result) {
+    // Blocks until the background evaluation finishes; false if none was started
+    if (!evaluator->running) return false;
+
+    pthread_join(evaluator->thread, NULL);
+
+    evaluator->running = false;
+    *result = evaluator->result;
+
+    return true;
+}
+
+void eval_result_print(EvalResult *result, size_t num_classes) {
+    printf("===== Eval(%zu examples) =====\n", result->num_examples);
+    printf("Loss: %f, Accuracy: %f, Time: %.3fs\n", result->loss, (double) result->num_correct / (double) result->num_examples, result->seconds);
+    printf("Confusion (rows: label, columns: prediction)\n");
+
+    for (size_t i = 0; i < num_classes; i++) {
+        printf("%4zu:", i);
+
+        for (size_t j = 0; j < num_classes; j++) {
+            printf(" %6zu", result->confusion[i][j]);
+        }
+
+        printf("\n");
+    }
+
+    printf("===========================\n");
+}
+
+#endif // EVAL_H
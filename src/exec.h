@@ -0,0 +1,391 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "plan.h"
+
+#define EXEC_SHARED     ((size_t) 1 << (sizeof(size_t) * 8 - 1))   // Marks a reference to a shared parameter
+#define EXEC_NO_STATE   SIZE_MAX
+#define EXEC_ALIGNMENT  16
+
+// One computed value, with every operand stored as a reference: an offset into the memory of an
+// ExecContext, or EXEC_SHARED | p for the data of the model's parameter p
+typedef struct {
+    Value   *value;
+    size_t  data;
+    size_t  grad;
+    size_t  state;          // Offset into the context's state blob, or EXEC_NO_STATE
+    size_t  *child_data;
+    size_t  *child_grad;
+    size_t  *child_state;   // NULL when no child has state
+} ExecStep;
+
+// The shared, read-only half of a model: its topology, a static memory plan and the parameters, which
+// are read in place from the graph. Nothing here is written while contexts run, so the parameters
+// must not be updated until they have finished.
+typedef struct {
+    ExecStep    *steps;
+    size_t      num_steps;
+    ExecStep    **backward_steps;
+    size_t      num_backward;
+    size_t      *zero_refs;         // Gradients to clear before backward step s:
+    size_t      *zero_offsets;      // zero_refs[zero_offsets[s]..zero_offsets[s + 1])
+
+    Value       **params;
+    size_t      num_params;
+    size_t      *param_grads;
+    size_t      *input_refs;
+    size_t      num_inputs;
+    size_t      *output_refs;
+    size_t      num_outputs;
+    size_t      *pinned_grads;      // The root's gradient comes first
+    size_t      num_pinned;
+    size_t      *leaf_grads;
+    size_t      num_leaves;
+
+    float       *initial_memory;    // Constants, and everything else at its value when the model was made
+    size_t      num_floats;
+    uint8_t     *initial_state;
+    size_t      state_size;
+    size_t      max_children;
+} ExecModel;
+
+// The private half: activations, gradients (parameter gradients included) and kernel state for one
+// caller. Each context is used by one thread at a time; any number of them can run at once.
+typedef struct {
+    ExecModel   *model;
+    float       *memory;
+    uint8_t     *state;
+    Value       scratch;
+    Value       *scratch_children;
+    Value       **scratch_pointers;
+} ExecContext;
+
+// Header
+
+ExecModel *exec_model_create(Arena *arena, Graph *graph, Value **inputs, size_t num_inputs, Value **outputs, size_t num_outputs);
+ExecContext *exec_context_create(Arena *arena, ExecModel *model);
+void exec_forward(ExecContext *ctx, const float *inputs);
+void exec_backward(ExecContext *ctx);
+void exec_zero_grad(ExecContext *ctx);
+float exec_output(ExecContext *ctx, size_t i);
+float exec_loss(ExecContext *ctx);
+float exec_param_grad(ExecContext *ctx, size_t p);
+size_t exec_context_size(ExecModel *model);
+
+size_t _exec_ref(MemoryPlan *plan, float *pointer, size_t *own, size_t *param_of, ValueMap *index, Value *value, bool grad);
+float _exec_load(ExecContext *ctx, size_t ref);
+void *_exec_state(ExecContext *ctx, size_t ref);
+void _exec_load_step(ExecContext *ctx, ExecStep *step);
+
+// Implementation
+
+size_t _exec_ref(MemoryPlan *plan, float *pointer, size_t *own, size_t *param_of, ValueMap *index, Value *value, bool grad) {
+    // The plan points either into its slots, spares included, or at the fields of a value with its own storage
+    if (pointer >= plan->slots && pointer <= plan->slots + plan->num_slots + 1) return (size_t) (pointer - plan->slots);
+
+    size_t position = value_map_find(index, value);
+
+    if (grad) return own[position] + 1;
+
+    return param_of[position] != SIZE_MAX ? EXEC_SHARED | param_of[position] : own[position];
+}
+
+ExecModel *exec_model_create(Arena *arena, Graph *graph, Value **inputs, size_t num_inputs, Value **outputs, size_t num_outputs) {
+    MemoryPlan *plan = plan_create(arena, graph, outputs, num_outputs);
+    ValueMap *index = graph_index_create(graph);
+    ExecModel *model = (ExecModel *) arena_allocate(arena, sizeof(ExecModel));
+    size_t num_values = graph->num_values;
+
+    *model = (ExecModel) {
+        .num_steps = plan->num_steps,
+        .num_backward = plan->num_backward,
+        .num_inputs = num_inputs,
+        .num_outputs = num_outputs,
+        .num_pinned = plan->num_pinned,
+        .num_leaves = plan->num_leaves
+    };
+
+    // Context memory: the plan's slots and its two spares, then a data and a gradient float for every
+    // leaf and pinned value. Parameter data is read from the graph instead.
+    size_t *own = (size_t *) calloc(num_values, sizeof(size_t));
+    size_t *param_of = (size_t *) calloc(num_values, sizeof(size_t));
+    size_t *state_of = (size_t *) calloc(num_values, sizeof(size_t));
+    Value **order = (Value **) calloc(plan->num_steps + 1, sizeof(Value *));
+    size_t next = plan->num_slots + 2;
+
+    for (size_t i = 0; i < plan->num_leaves; i++) {
+        model->num_params += !plan->leaves[i]->not_trainable ? 1 : 0;
+    }
+
+    model->params = (Value **) arena_allocate(arena, sizeof(Value *) * (model->num_params + 1));
+    model->param_grads = (size_t *) arena_allocate(arena, sizeof(size_t) * (model->num_params + 1));
+    model->leaf_grads = (size_t *) arena_allocate(arena, sizeof(size_t) * (plan->num_leaves + 1));
+    model->pinned_grads = (size_t *) arena_allocate(arena, sizeof(size_t) * (plan->num_pinned + 1));
+    model->num_params = 0;
+
+    for (size_t i = 0; i < num_values; i++) {
+        param_of[i] = SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < plan->num_leaves; i++) {
+        Value *leaf = plan->leaves[i];
+        size_t position = value_map_find(index, leaf);
+
+        own[position] = next;
+        model->leaf_grads[i] = next + 1;
+
+        if (!leaf->not_trainable) {
+            param_of[position] = model->num_params;
+            model->param_grads[model->num_params] = next + 1;
+            model->params[model->num_params++] = leaf;
+        }
+
+        next += 2;
+    }
+
+    for (size_t i = 0; i < plan->num_pinned; i++) {
+        own[value_map_find(index, plan->pinned[i])] = next;
+        model->pinned_grads[i] = next + 1;
+        next += 2;
+    }
+
+    model->num_floats = next;
+    model->initial_memory = (float *) arena_allocate(arena, sizeof(float) * model->num_floats);
+    memset(model->initial_memory, 0, sizeof(float) * model->num_floats);
+
+    for (size_t i = 0; i < plan->num_leaves; i++) {
+        model->initial_memory[own[value_map_find(index, plan->leaves[i])]] = plan->leaves[i]->data;
+    }
+
+    // Kernel state is written during forward (sparse positions, convolution buffers), so every context
+    // gets its own copy of every blob
+    for (size_t i = 0; i < num_values; i++) {
+        Value *value = graph->values[i];
+
+        state_of[i] = value->state ? model->state_size : EXEC_NO_STATE;
+        model->state_size += value->state ? (value->state_size + EXEC_ALIGNMENT - 1) / EXEC_ALIGNMENT * EXEC_ALIGNMENT : 0;
+    }
+
+    model->initial_state = (uint8_t *) arena_allocate(arena, model->state_size + 1);
+
+    for (size_t i = 0; i < num_values; i++) {
+        Value *value = graph->values[i];
+        if (value->state) memcpy(model->initial_state + state_of[i], value->state, value->state_size);
+    }
+
+    model->input_refs = (size_t *) arena_allocate(arena, sizeof(size_t) * (num_inputs + 1));
+    model->output_refs = (size_t *) arena_allocate(arena, sizeof(size_t) * (num_outputs + 1));
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        size_t position = value_map_find(index, inputs[i]);
+
+        // An input the graph never reads is written to the write-only spare slot
+        model->input_refs[i] = position != SIZE_MAX && param_of[position] == SIZE_MAX ? own[position] : plan->num_slots + 1;
+    }
+
+    for (size_t i = 0; i < num_outputs; i++) {
+        size_t position = value_map_find(index, outputs[i]);
+        model->output_refs[i] = position != SIZE_MAX ? own[position] : plan->num_slots;
+    }
+
+    model->steps = (ExecStep *) arena_allocate(arena, sizeof(ExecStep) * (plan->num_steps + 1));
+    model->backward_steps = (ExecStep **) arena_allocate(arena, sizeof(ExecStep *) * (plan->num_backward + 1));
+
+    // The plan's steps are the graph's computed values from last to first
+    for (size_t i = num_values, s = 0; i > 0; i--) {
+        if (graph->values[i - 1]->forward) order[s++] = graph->values[i - 1];
+    }
+
+    for (size_t s = 0; s < plan->num_steps; s++) {
+        PlanStep *plan_step = &plan->steps[s];
+        Value *value = order[s];
+        ExecStep *step = &model->steps[s];
+        bool generic = plan_step->kernel == PLAN_KERNEL_GENERIC;
+        float **child_data = generic ? plan->generic[plan_step->generic].child_data : plan_step->child_data;
+        float **child_grad = generic ? plan->generic[plan_step->generic].child_grad : plan_step->child_grad;
+        bool child_state = false;
+
+        *step = (ExecStep) {
+            .value = value,
+            .data = _exec_ref(plan, plan_step->data, own, param_of, index, value, false),
+            .grad = _exec_ref(plan, plan_step->grad, own, param_of, index, value, true),
+            .state = state_of[value_map_find(index, value)]
+        };
+
+        step->child_data = (size_t *) arena_allocate(arena, sizeof(size_t) * (value->num_children + 1));
+        step->child_grad = (size_t *) arena_allocate(arena, sizeof(size_t) * (value->num_children + 1));
+
+        for (size_t j = 0; j < value->num_children; j++) {
+            step->child_data[j] = _exec_ref(plan, child_data[j], own, param_of, index, value->children[j], false);
+            step->child_grad[j] = _exec_ref(plan, child_grad[j], own, param_of, index, value->children[j], true);
+            child_state = child_state || value->children[j]->state;
+        }
+
+        if (child_state) {
+            step->child_state = (size_t *) arena_allocate(arena, sizeof(size_t) * (value->num_children + 1));
+
+            for (size_t j = 0; j < value->num_children; j++) {
+                step->child_state[j] = state_of[value_map_find(index, value->children[j])];
+            }
+        }
+
+        model->max_children = value->num_children > model->max_children ? value->num_children : model->max_children;
+    }
+
+    for (size_t s = 0; s < plan->num_backward; s++) {
+        model->backward_steps[s] = &model->steps[plan->backward_steps[s]];
+    }
+
+    model->zero_offsets = (size_t *) arena_allocate(arena, sizeof(size_t) * (plan->num_backward + 2));
+    model->zero_refs = (size_t *) arena_allocate(arena, sizeof(size_t) * (plan->zero_offsets[plan->num_backward] + 1));
+    memcpy(model->zero_offsets, plan->zero_offsets, sizeof(size_t) * (plan->num_backward + 1));
+
+    for (size_t z = 0; z < plan->zero_offsets[plan->num_backward]; z++) {
+        model->zero_refs[z] = plan->zero_slots[z];
+    }
+
+    free(order);
+    order = NULL;
+    free(state_of);
+    state_of = NULL;
+    free(param_of);
+    param_of = NULL;
+    free(own);
+    own = NULL;
+    value_map_destroy(index);
+    index = NULL;
+
+    return model;
+}
+
+ExecContext *exec_context_create(Arena *arena, ExecModel *model) {
+    ExecContext *ctx = (ExecContext *) arena_allocate(arena, sizeof(ExecContext));
+
+    *ctx = (ExecContext) {
+        .model = model
+    };
+
+    ctx->memory = (float *) arena_allocate(arena, sizeof(float) * model->num_floats);
+    ctx->state = (uint8_t *) arena_allocate(arena, model->state_size + 1);
+    memcpy(ctx->memory, model->initial_memory, sizeof(float) * model->num_floats);
+    memcpy(ctx->state, model->initial_state, model->state_size);
+
+    ctx->scratch_children = (Value *) arena_allocate(arena, sizeof(Value) * (model->max_children + 1));
+    ctx->scratch_pointers = (Value **) arena_allocate(arena, sizeof(Value *) * (model->max_children + 1));
+
+    for (size_t j = 0; j < model->max_children; j++) {
+        ctx->scratch_children[j] = (Value) { .repr = 'v' };
+        ctx->scratch_pointers[j] = &ctx->scratch_children[j];
+    }
+
+    ctx->scratch = (Value) {
+        .children = ctx->scratch_pointers
+    };
+
+    return ctx;
+}
+
+size_t exec_context_size(ExecModel *model) {
+    return sizeof(ExecContext) + sizeof(float) * model->num_floats + model->state_size + (sizeof(Value) + sizeof(Value *)) * model->max_children;
+}
+
+float _exec_load(ExecContext *ctx, size_t ref) {
+    return ref & EXEC_SHARED ? ctx->model->params[ref & ~EXEC_SHARED]->data : ctx->memory[ref];
+}
+
+void *_exec_state(ExecContext *ctx, size_t ref) {
+    return ref == EXEC_NO_STATE ? NULL : ctx->state + ref;
+}
+
+void _exec_load_step(ExecContext *ctx, ExecStep *step) {
+    Value *self = &ctx->scratch;
+    Value *value = step->value;
+
+    self->repr = value->repr;
+    self->state = _exec_state(ctx, step->state);
+    self->data = ctx->memory[step->data];
+    self->num_children = value->num_children;
+
+    for (size_t j = 0; j < value->num_children; j++) {
+        ctx->scratch_children[j].data = _exec_load(ctx, step->child_data[j]);
+        ctx->scratch_children[j].state = step->child_state ? _exec_state(ctx, step->child_state[j]) : NULL;
+    }
+}
+
+void exec_forward(ExecContext *ctx, const float *inputs) {
+    // inputs holds one float per model input, or is NULL to keep the ones already in the context
+    ExecModel *model = ctx->model;
+
+    for (size_t i = 0; inputs && i < model->num_inputs; i++) {
+        ctx->memory[model->input_refs[i]] = inputs[i];
+    }
+
+    for (size_t s = 0; s < model->num_steps; s++) {
+        ExecStep *step = &model->steps[s];
+
+        _exec_load_step(ctx, step);
+        step->value->forward(&ctx->scratch);
+        ctx->memory[step->data] = ctx->scratch.data;
+    }
+}
+
+void exec_backward(ExecContext *ctx) {
+    // Parameter gradients accumulate in the context until exec_zero_grad
+    ExecModel *model = ctx->model;
+
+    for (size_t i = 0; i < model->num_pinned; i++) {
+        ctx->memory[model->pinned_grads[i]] = 0;
+    }
+
+    ctx->memory[model->pinned_grads[0]] = 1;
+
+    for (size_t s = 0; s < model->num_backward; s++) {
+        ExecStep *step = model->backward_steps[s];
+        Value *value = step->value;
+
+        for (size_t z = model->zero_offsets[s]; z < model->zero_offsets[s + 1]; z++) {
+            ctx->memory[model->zero_refs[z]] = 0;
+        }
+
+        _exec_load_step(ctx, step);
+        ctx->scratch.grad = ctx->memory[step->grad];
+
+        for (size_t j = 0; j < value->num_children; j++) {
+            ctx->scratch_children[j].grad = 0;
+        }
+
+        value->backward(&ctx->scratch);
+
+        for (size_t j = 0; j < value->num_children; j++) {
+            ctx->memory[step->child_grad[j]] += ctx->scratch_children[j].grad;
+        }
+    }
+}
+
+void exec_zero_grad(ExecContext *ctx) {
+    for (size_t i = 0; i < ctx->model->num_leaves; i++) {
+        ctx->memory[ctx->model->leaf_grads[i]] = 0;
+    }
+}
+
+float exec_output(ExecContext *ctx, size_t i) {
+    return ctx->memory[ctx->model->output_refs[i]];
+}
+
+float exec_loss(ExecContext *ctx) {
+    // The root is the first pinned value, and its data sits just before its gradient
+    return ctx->memory[ctx->model->pinned_grads[0] - 1];
+}
+
+float exec_param_grad(ExecContext *ctx, size_t p) {
+    return ctx->memory[ctx->model->param_grads[p]];
+}
+
+#endif // EXEC_H
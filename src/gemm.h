@@ -0,0 +1,51 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+
+// Row-major single precision matrix products on contiguous buffers. Every routine accumulates into C.
+// The loops are blocked so that a panel of B stays in cache while the rows of A stream past it, and the
+// innermost loops run over contiguous memory so the compiler vectorises them.
+
+#define GEMM_BLOCK_M    64
+#define GEMM_BLOCK_N    256
+#define GEMM_BLOCK_K    128
+
+// Header
+
+void gemm_nn(size_t m, size_t n, size_t k, const float *a, size_t a_row_stride, size_t a_col_stride, const float *b, float *c);
+
+// Implementation
+
+void gemm_nn(size_t m, size_t n, size_t k, const float *a, size_t a_row_stride, size_t a_col_stride, const float *b, float *c) {
+    // C[m x n] += A[m x k] * B[k x n]. A is read through strides, so passing (1, m) instead of (k, 1)
+    // multiplies by its transpose without copying it.
+    for (size_t kk = 0; kk < k; kk += GEMM_BLOCK_K) {
+        size_t k_end = kk + GEMM_BLOCK_K < k ? kk + GEMM_BLOCK_K : k;
+
+        for (size_t jj = 0; jj < n; jj += GEMM_BLOCK_N) {
+            size_t n_block = jj + GEMM_BLOCK_N < n ? GEMM_BLOCK_N : n - jj;
+
+            for (size_t ii = 0; ii < m; ii += GEMM_BLOCK_M) {
+                size_t i_end = ii + GEMM_BLOCK_M < m ? ii + GEMM_BLOCK_M : m;
+
+                for (size_t i = ii; i < i_end; i++) {
+                    float *restrict c_row = c + i * n + jj;
+
+                    for (size_t p = kk; p < k_end; p++) {
+                        float a_ip = a[i * a_row_stride + p * a_col_stride];
+                        const float *restrict b_row = b + p * n + jj;
+
+                        if (a_ip == 0) continue;
+
+                        for (size_t j = 0; j < n_block; j++) {
+                            c_row[j] += a_ip * b_row[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif // GEMM_H
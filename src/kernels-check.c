@@ -0,0 +1,331 @@
+/*
+
+Check every kernel backend this CPU supports against the scalar reference on odd sizes (so the vector
+tails are exercised) and time the main kernels
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "kernels.h"
+#include "random.h"
+#include "timing.h"
+
+#define MAX_SIZE        1031
+#define EXP_RANGE       100.0f  // The exp range check sweeps [-EXP_RANGE, EXP_RANGE], past both clamps
+#define GEMM_M          37
+#define GEMM_N          259
+#define GEMM_K          131
+#define BENCH_REPEATS   200
+#define TOLERANCE       1e-5f   // Relative to the magnitude of the terms, not of the result
+
+float *buffer_create(size_t n) {
+    float *buffer = calloc(n, sizeof(float));
+
+    for (size_t i = 0; i < n; i++) {
+        buffer[i] = 8.0f * rng_uniform(rng_thread()) - 4.0f;
+    }
+
+    return buffer;
+}
+
+float relative_error(const float *got, const float *expected, const float *scale, size_t n) {
+    float worst = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        float error = fabsf(got[i] - expected[i]) / (1.0f + fabsf(scale[i]));
+        worst = error > worst ? error : worst;
+    }
+
+    return worst;
+}
+
+float check_backend(KernelBackend *backend, KernelBackend *reference) {
+    float *a = buffer_create(MAX_SIZE);
+    float *b = buffer_create(MAX_SIZE);
+    float *got = calloc(MAX_SIZE, sizeof(float));
+    float *expected = calloc(MAX_SIZE, sizeof(float));
+    float *scale = calloc(MAX_SIZE, sizeof(float));
+    float worst = 0;
+
+    for (size_t n = 0; n <= MAX_SIZE; n += n < 40 ? 1 : 61) {
+        float abs_dot = 0, abs_sum = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            abs_dot += fabsf(a[i] * b[i]);
+            abs_sum += fabsf(a[i]);
+        }
+
+        // Reductions: the error grows with the sum of the magnitudes of the terms
+        float errors[] = {
+            fabsf(backend->dot(a, b, n) - reference->dot(a, b, n)) / (1.0f + abs_dot),
+            fabsf(backend->sum(a, n) - reference->sum(a, n)) / (1.0f + abs_sum),
+            n ? fabsf(backend->max(a, n) - reference->max(a, n)) : 0
+        };
+
+        for (size_t i = 0; i < 3; i++) {
+            worst = errors[i] > worst ? errors[i] : worst;
+        }
+
+        // Elementwise kernels must also leave everything past n untouched
+        for (size_t kernel = 0; kernel < 4; kernel++) {
+            for (size_t i = 0; i < MAX_SIZE; i++) {
+                got[i] = expected[i] = b[i];
+                scale[i] = kernel == 1 ? expected[i] : 0;
+            }
+
+            if (kernel == 0) { backend->exp(a, got, n); reference->exp(a, expected, n); }
+            if (kernel == 1) { backend->axpy(n, 0.75f, a, got); reference->axpy(n, 0.75f, a, expected); }
+            if (kernel == 2) { backend->sigmoid(a, got, n); reference->sigmoid(a, expected, n); }
+            if (kernel == 3) { backend->relu(a, got, n); reference->relu(a, expected, n); }
+
+            // exp is compared relative to its result, since it spans several orders of magnitude
+            if (kernel == 0) {
+                for (size_t i = 0; i < n; i++) {
+                    scale[i] = expected[i];
+                }
+            }
+
+            float error = relative_error(got, expected, scale, MAX_SIZE);
+            worst = error > worst ? error : worst;
+        }
+    }
+
+    free(a);
+    free(b);
+    free(got);
+    free(expected);
+    free(scale);
+
+    return worst;
+}
+
+void exp_approx_buffer(const float *x, float *y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] = expf_approx(x[i]);
+    }
+}
+
+float check_exp_range(void (*exp)(const float *x, float *y, size_t n)) {
+    // Against libm over the whole float range: zero below KERNELS_EXP_MIN, finite and saturated above
+    // KERNELS_EXP_MAX, and the usual relative error in between, including the values next to both clamps
+    float *x = calloc(MAX_SIZE, sizeof(float));
+    float *got = calloc(MAX_SIZE, sizeof(float));
+    float *expected = calloc(MAX_SIZE, sizeof(float));
+    float saturated = expf_approx(KERNELS_EXP_MAX);
+    float worst = 0;
+
+    for (size_t i = 0; i < MAX_SIZE; i++) {
+        x[i] = -EXP_RANGE + 2 * EXP_RANGE * (float) i / (float) (MAX_SIZE - 1);
+    }
+
+    float edges[] = { KERNELS_EXP_MIN, nextafterf(KERNELS_EXP_MIN, 0), nextafterf(KERNELS_EXP_MIN, -INFINITY),
+        KERNELS_EXP_MAX, nextafterf(KERNELS_EXP_MAX, 0), nextafterf(KERNELS_EXP_MAX, INFINITY), -INFINITY, INFINITY };
+
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        x[i * 97] = edges[i];
+    }
+
+    exp(x, got, MAX_SIZE);
+
+    for (size_t i = 0; i < MAX_SIZE; i++) {
+        float error;
+
+        if (x[i] < KERNELS_EXP_MIN) {
+            error = got[i] == 0 ? 0 : INFINITY;
+        }
+        else if (x[i] > KERNELS_EXP_MAX) {
+            error = got[i] == saturated && isfinite(got[i]) ? 0 : INFINITY;
+        }
+        else {
+            expected[i] = expf(x[i]);
+            error = isfinite(got[i]) ? fabsf(got[i] - expected[i]) / fabsf(expected[i]) : INFINITY;
+        }
+
+        worst = error > worst ? error : worst;
+    }
+
+    free(x);
+    free(got);
+    free(expected);
+
+    return worst;
+}
+
+float check_matrix_products(KernelBackend *backend, KernelBackend *reference) {
+    float *a = buffer_create(GEMM_M * GEMM_K);
+    float *b = buffer_create(GEMM_K * GEMM_N);
+    float *x = buffer_create(GEMM_K);
+    float *got = calloc(GEMM_M * GEMM_N, sizeof(float));
+    float *expected = calloc(GEMM_M * GEMM_N, sizeof(float));
+    float *scale = calloc(GEMM_M * GEMM_N, sizeof(float));
+    float worst = 0;
+
+    // Both layouts of A that conv.h uses: row-major and transposed through the strides
+    for (size_t transposed = 0; transposed < 2; transposed++) {
+        size_t row_stride = transposed ? 1 : GEMM_K;
+        size_t col_stride = transposed ? GEMM_M : 1;
+
+        for (size_t i = 0; i < GEMM_M * GEMM_N; i++) {
+            got[i] = expected[i] = 1.0f;
+            scale[i] = 0;
+        }
+
+        backend->gemm(GEMM_M, GEMM_N, GEMM_K, a, row_stride, col_stride, b, got);
+        reference->gemm(GEMM_M, GEMM_N, GEMM_K, a, row_stride, col_stride, b, expected);
+
+        for (size_t i = 0; i < GEMM_M; i++) {
+            for (size_t j = 0; j < GEMM_N; j++) {
+                for (size_t p = 0; p < GEMM_K; p++) {
+                    scale[i * GEMM_N + j] += fabsf(a[i * row_stride + p * col_stride] * b[p * GEMM_N + j]);
+                }
+            }
+        }
+
+        float error = relative_error(got, expected, scale, GEMM_M * GEMM_N);
+        worst = error > worst ? error : worst;
+    }
+
+    for (size_t i = 0; i < GEMM_M; i++) {
+        got[i] = expected[i] = 0;
+        scale[i] = reference->dot(a + i * GEMM_K, a + i * GEMM_K, GEMM_K) + reference->dot(x, x, GEMM_K);
+    }
+
+    backend->gemv(GEMM_M, GEMM_K, a, x, got);
+    reference->gemv(GEMM_M, GEMM_K, a, x, expected);
+
+    float error = relative_error(got, expected, scale, GEMM_M);
+    worst = error > worst ? error : worst;
+
+    free(a);
+    free(b);
+    free(x);
+    free(got);
+    free(expected);
+    free(scale);
+
+    return worst;
+}
+
+int8_t *buffer_create_s8(size_t n) {
+    int8_t *buffer = calloc(n, sizeof(int8_t));
+
+    // The full byte range, -128 included, so the widening multiplies see the extremes
+    for (size_t i = 0; i < n; i++) {
+        buffer[i] = (int8_t) (rng_next(rng_thread()) & 0xff);
+    }
+
+    return buffer;
+}
+
+size_t check_int8(KERNEL_ISA isa, KernelBackend *reference) {
+    // Integer products are exact, so any difference from the scalar reference is a mismatch
+    KernelBackend *backend = kernels_backend(isa);
+    int8_t *a = buffer_create_s8(GEMM_M * GEMM_K);
+    int8_t *b = buffer_create_s8(GEMM_N * GEMM_K);
+    int32_t *c = calloc(GEMM_M * GEMM_N, sizeof(int32_t));
+    size_t mismatches = 0;
+
+    for (size_t n = 0; n <= GEMM_K; n++) {
+        mismatches += backend->dot_s8(a, b, n) != reference->dot_s8(a, b, n);
+    }
+
+    // The GEMM runs on the active backend
+    kernels_use(isa);
+    kernels_gemm_s8_nt(GEMM_M, GEMM_N, GEMM_K, a, b, c);
+
+    for (size_t i = 0; i < GEMM_M; i++) {
+        for (size_t j = 0; j < GEMM_N; j++) {
+            int32_t expected = 0;
+
+            for (size_t p = 0; p < GEMM_K; p++) {
+                expected += (int32_t) a[i * GEMM_K + p] * b[j * GEMM_K + p];
+            }
+
+            mismatches += c[i * GEMM_N + j] != expected;
+        }
+    }
+
+    free(a);
+    free(b);
+    free(c);
+
+    return mismatches;
+}
+
+void benchmark(KernelBackend *backend) {
+    float *a = buffer_create(GEMM_M * GEMM_K);
+    float *b = buffer_create(GEMM_K * GEMM_N);
+    float *c = calloc(GEMM_M * GEMM_N, sizeof(float));
+    float *y = calloc(GEMM_K * GEMM_N, sizeof(float));
+    volatile float sink = 0;
+
+    double start = time_now_seconds();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) backend->gemm(GEMM_M, GEMM_N, GEMM_K, a, GEMM_K, 1, b, c);
+    double gemm_seconds = time_now_seconds() - start;
+
+    start = time_now_seconds();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) sink += backend->dot(b, b, GEMM_K * GEMM_N);
+    double dot_seconds = time_now_seconds() - start;
+
+    start = time_now_seconds();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) backend->sigmoid(b, y, GEMM_K * GEMM_N);
+    double sigmoid_seconds = time_now_seconds() - start;
+
+    int8_t *s8 = buffer_create_s8(GEMM_K * GEMM_N);
+    volatile int32_t sink_s8 = 0;
+
+    start = time_now_seconds();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) sink_s8 += backend->dot_s8(s8, s8, GEMM_K * GEMM_N);
+    double dot_s8_seconds = time_now_seconds() - start;
+
+    double gemm_flops = 2.0 * GEMM_M * GEMM_N * GEMM_K * BENCH_REPEATS;
+    double elements = (double) GEMM_K * GEMM_N * BENCH_REPEATS;
+
+    printf("  gemm %7.2f GFLOP/s   dot %7.2f GFLOP/s   dot int8 %7.2f GOP/s   sigmoid %7.1f M/s\n",
+        gemm_flops / gemm_seconds / 1e9, 2 * elements / dot_seconds / 1e9, 2 * elements / dot_s8_seconds / 1e9, elements / sigmoid_seconds / 1e6);
+
+    free(a);
+    free(b);
+    free(c);
+    free(y);
+    free(s8);
+}
+
+int main(void) {
+    rng_set_seed(42);
+
+    KernelBackend *reference = kernels_backend(KERNEL_SCALAR);
+    int failures = 0;
+
+    printf("Selected backend: %s\n\n", kernels()->name);
+
+    for (int isa = 0; isa < KERNEL_COUNT; isa++) {
+        KernelBackend *backend = kernels_backend((KERNEL_ISA) isa);
+
+        if (!backend) {
+            printf("%-8s not supported on this CPU\n", isa == KERNEL_SSE42 ? "sse4.2" : isa == KERNEL_AVX2 ? "avx2" : "avx512");
+            continue;
+        }
+
+        float vector_error = check_backend(backend, reference);
+        float matrix_error = check_matrix_products(backend, reference);
+        // The scalar backend is libm's expf itself, so its row checks the polynomial the SIMD variants mirror
+        float exp_error = check_exp_range(isa == KERNEL_SCALAR ? exp_approx_buffer : backend->exp);
+        size_t int8_mismatches = check_int8((KERNEL_ISA) isa, reference);
+        bool passed = vector_error <= TOLERANCE && matrix_error <= TOLERANCE && exp_error <= TOLERANCE && int8_mismatches == 0;
+
+        printf("%-8s vector error %.2e   matrix error %.2e   exp range error %.2e   int8 mismatches %zu   %s\n",
+            backend->name, vector_error, matrix_error, exp_error, int8_mismatches, passed ? "PASS" : "FAIL");
+        benchmark(backend);
+
+        failures += !passed;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,809 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#include "gemm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELS_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Vector kernels on contiguous float buffers. Every backend implements the same table; the best one
+// the machine supports is picked the first time kernels() is called, so one binary runs everywhere.
+// The SIMD variants are compiled with per-function target attributes and only ever called after the
+// CPU (and the OS, for the wider registers) has been checked.
+
+#define KERNELS_EXP_MIN     -87.33654f  // ln(FLT_MIN): below this expf is denormal, and exp flushes it to zero
+#define KERNELS_EXP_MAX     88.37626f   // 127.5 / log2(e): the largest input whose 2^n scale is finite
+
+typedef enum {
+    KERNEL_SCALAR,
+    KERNEL_SSE42,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+    KERNEL_COUNT
+} KERNEL_ISA;
+
+typedef struct {
+    const char  *name;
+    float       (*dot)      (const float *a, const float *b, size_t n);
+    void        (*axpy)     (size_t n, float alpha, const float *x, float *y);                 // y += alpha * x
+    void        (*gemv)     (size_t m, size_t n, const float *a, const float *x, float *y);    // y[m] += A[m x n] * x
+    void        (*gemm)     (size_t m, size_t n, size_t k, const float *a, size_t a_row_stride, size_t a_col_stride, const float *b, float *c);
+    void        (*exp)      (const float *x, float *y, size_t n);
+    void        (*sigmoid)  (const float *x, float *y, size_t n);
+    void        (*relu)     (const float *x, float *y, size_t n);
+    float       (*sum)      (const float *x, size_t n);
+    float       (*max)      (const float *x, size_t n);
+    int32_t     (*dot_s8)   (const int8_t *a, const int8_t *b, size_t n);                      // Exact, accumulates in 32 bits
+} KernelBackend;
+
+// Header
+
+KernelBackend *kernels(void);
+KernelBackend *kernels_backend(KERNEL_ISA isa);
+bool kernels_supported(KERNEL_ISA isa);
+bool kernels_use(KERNEL_ISA isa);
+void kernels_gemm_nt(size_t m, size_t n, size_t k, const float *a, const float *b, float *c);
+void kernels_gemm_s8_nt(size_t m, size_t n, size_t k, const int8_t *a, const int8_t *b, int32_t *c);
+float expf_approx(float x);
+
+void _gemm_blocked(size_t m, size_t n, size_t k, const float *a, size_t a_row_stride, size_t a_col_stride, const float *b, float *c, void (*axpy)(size_t, float, const float *, float *));
+void _gemv_rows(size_t m, size_t n, const float *a, const float *x, float *y, float (*dot)(const float *, const float *, size_t));
+
+// Implementation
+
+_Atomic(KernelBackend *) _kernels_active = NULL;
+
+float expf_approx(float x) {
+    // exp(x) = 2^n * exp(r) with |r| <= ln(2) / 2 and a degree 6 polynomial for exp(r) (Cephes expf).
+    // The SIMD variants below compute exactly this, lane by lane.
+    // Saturates at exp(KERNELS_EXP_MAX) ~ 2.4e38 instead of overflowing to infinity
+    if (x < KERNELS_EXP_MIN) return 0;
+
+    x = x > KERNELS_EXP_MAX ? KERNELS_EXP_MAX : x;
+
+    float n = roundf(x * 1.44269504088896341f);
+    float r = x - n * 0.693359375f + n * 2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+
+    p = p * r + 1.3981999507e-3f;
+    p = p * r + 8.3334519073e-3f;
+    p = p * r + 4.1665795894e-2f;
+    p = p * r + 1.6666665459e-1f;
+    p = p * r + 5.0000001201e-1f;
+    p = p * r * r + r + 1.0f;
+
+    int32_t bits = ((int32_t) n + 127) << 23;
+    float scale;
+
+    memcpy(&scale, &bits, sizeof(float));
+
+    return p * scale;
+}
+
+void _gemm_blocked(size_t m, size_t n, size_t k, const float *a, size_t a_row_stride, size_t a_col_stride, const float *b, float *c, void (*axpy)(size_t, float, const float *, float *)) {
+    // Same blocking as gemm_nn, with the row update done by a backend's axpy
+    for (size_t kk = 0; kk < k; kk += GEMM_BLOCK_K) {
+        size_t k_end = kk + GEMM_BLOCK_K < k ? kk + GEMM_BLOCK_K : k;
+
+        for (size_t jj = 0; jj < n; jj += GEMM_BLOCK_N) {
+            size_t n_block = jj + GEMM_BLOCK_N < n ? GEMM_BLOCK_N : n - jj;
+
+            for (size_t ii = 0; ii < m; ii += GEMM_BLOCK_M) {
+                size_t i_end = ii + GEMM_BLOCK_M < m ? ii + GEMM_BLOCK_M : m;
+
+                for (size_t i = ii; i < i_end; i++) {
+                    for (size_t p = kk; p < k_end; p++) {
+                        float a_ip = a[i * a_row_stride + p * a_col_stride];
+
+                        if (a_ip != 0) axpy(n_block, a_ip, b + p * n + jj, c + i * n + jj);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void _gemv_rows(size_t m, size_t n, const float *a, const float *x, float *y, float (*dot)(const float *, const float *, size_t)) {
+    for (size_t i = 0; i < m; i++) {
+        y[i] += dot(a + i * n, x, n);
+    }
+}
+
+// Scalar reference
+
+float _dot_scalar(const float *a, const float *b, size_t n) {
+    float sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+void _axpy_scalar(size_t n, float alpha, const float *x, float *y) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+void _gemv_scalar(size_t m, size_t n, const float *a, const float *x, float *y) {
+    _gemv_rows(m, n, a, x, y, _dot_scalar);
+}
+
+void _exp_scalar(const float *x, float *y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] = expf(x[i]);
+    }
+}
+
+void _sigmoid_scalar(const float *x, float *y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] = 1.0f / (1.0f + expf(-x[i]));
+    }
+}
+
+void _relu_scalar(const float *x, float *y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] = x[i] > 0 ? x[i] : 0;
+    }
+}
+
+float _sum_scalar(const float *x, size_t n) {
+    float sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += x[i];
+    }
+
+    return sum;
+}
+
+float _max_scalar(const float *x, size_t n) {
+    float best = -INFINITY;
+
+    for (size_t i = 0; i < n; i++) {
+        best = x[i] > best ? x[i] : best;
+    }
+
+    return best;
+}
+
+int32_t _dot_s8_scalar(const int8_t *a, const int8_t *b, size_t n) {
+    int32_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += (int32_t) a[i] * b[i];
+    }
+
+    return sum;
+}
+
+#ifdef KERNELS_X86
+
+// SSE4.2: 4 lanes, no FMA
+
+#define KERNELS_SSE42 __attribute__((target("sse4.2")))
+
+KERNELS_SSE42 float _hsum_sse42(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+
+    return _mm_cvtss_f32(v);
+}
+
+KERNELS_SSE42 __m128 _exp_sse42_ps(__m128 x) {
+    __m128 underflow = _mm_cmplt_ps(x, _mm_set1_ps(KERNELS_EXP_MIN));
+
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(KERNELS_EXP_MIN)), _mm_set1_ps(KERNELS_EXP_MAX));
+
+    __m128 n = _mm_round_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m128 r = _mm_add_ps(_mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f))), _mm_mul_ps(n, _mm_set1_ps(2.12194440e-4f)));
+    __m128 p = _mm_set1_ps(1.9875691500e-4f);
+
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201e-1f));
+    p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r), _mm_set1_ps(1.0f));
+
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+
+    return _mm_andnot_ps(underflow, _mm_mul_ps(p, _mm_castsi128_ps(bits)));
+}
+
+KERNELS_SSE42 float _dot_sse42(const float *a, const float *b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+
+    float sum = _hsum_sse42(_mm_add_ps(acc0, acc1));
+
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+KERNELS_SSE42 void _axpy_sse42(size_t n, float alpha, const float *x, float *y) {
+    __m128 va = _mm_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+    }
+
+    for (; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+void _gemv_sse42(size_t m, size_t n, const float *a, const float *x, float *y) {
+    _gemv_rows(m, n, a, x, y, _dot_sse42);
+}
+
+void _gemm_sse42(size_t m, size_t n, size_t k, const float *a, size_t a_row_stride, size_t a_col_stride, const float *b, float *c) {
+    _gemm_blocked(m, n, k, a, a_row_stride, a_col_stride, b, c, _axpy_sse42);
+}
+
+KERNELS_SSE42 void _exp_sse42(const float *x, float *y, size_t n) {
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(y + i, _exp_sse42_ps(_mm_loadu_ps(x + i)));
+    }
+
+    for (; i < n; i++) {
+        y[i] = expf_approx(x[i]);
+    }
+}
+
+KERNELS_SSE42 void _sigmoid_sse42(const float *x, float *y, size_t n) {
+    __m128 one = _mm_set1_ps(1.0f);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 e = _exp_sse42_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(x + i)));
+        _mm_storeu_ps(y + i, _mm_div_ps(one, _mm_add_ps(one, e)));
+    }
+
+    for (; i < n; i++) {
+        y[i] = 1.0f / (1.0f + expf_approx(-x[i]));
+    }
+}
+
+KERNELS_SSE42 void _relu_sse42(const float *x, float *y, size_t n) {
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(y + i, _mm_max_ps(_mm_loadu_ps(x + i), _mm_setzero_ps()));
+    }
+
+    for (; i < n; i++) {
+        y[i] = x[i] > 0 ? x[i] : 0;
+    }
+}
+
+KERNELS_SSE42 float _sum_sse42(const float *x, size_t n) {
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_loadu_ps(x + i));
+    }
+
+    float sum = _hsum_sse42(acc);
+
+    for (; i < n; i++) {
+        sum += x[i];
+    }
+
+    return sum;
+}
+
+KERNELS_SSE42 float _max_sse42(const float *x, size_t n) {
+    __m128 best = _mm_set1_ps(-INFINITY);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        best = _mm_max_ps(best, _mm_loadu_ps(x + i));
+    }
+
+    best = _mm_max_ps(best, _mm_movehl_ps(best, best));
+    best = _mm_max_ss(best, _mm_shuffle_ps(best, best, 1));
+
+    float result = _mm_cvtss_f32(best);
+
+    for (; i < n; i++) {
+        result = x[i] > result ? x[i] : result;
+    }
+
+    return result;
+}
+
+KERNELS_SSE42 int32_t _dot_s8_sse42(const int8_t *a, const int8_t *b, size_t n) {
+    // Sign-extend 8 bytes to 16 bits, then madd multiplies them and adds neighbouring pairs into 32 bits
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *) (a + i)));
+        __m128i vb = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *) (b + i)));
+
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+    }
+
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    int32_t sum = _mm_cvtsi128_si32(acc);
+
+    for (; i < n; i++) {
+        sum += (int32_t) a[i] * b[i];
+    }
+
+    return sum;
+}
+
+// AVX2 with FMA: 8 lanes
+
+#define KERNELS_AVX2 __attribute__((target("avx2,fma")))
+
+KERNELS_AVX2 float _hsum_avx2(__m256 v) {
+    __m128 low = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+
+    low = _mm_add_ps(low, _mm_movehl_ps(low, low));
+    low = _mm_add_ss(low, _mm_shuffle_ps(low, low, 1));
+
+    return _mm_cvtss_f32(low);
+}
+
+KERNELS_AVX2 __m256 _exp_avx2_ps(__m256 x) {
+    __m256 underflow = _mm256_cmp_ps(x, _mm256_set1_ps(KERNELS_EXP_MIN), _CMP_LT_OQ);
+
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(KERNELS_EXP_MIN)), _mm256_set1_ps(KERNELS_EXP_MAX));
+
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fmadd_ps(n, _mm256_set1_ps(2.12194440e-4f), r);
+
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(p, r), r, r), _mm256_set1_ps(1.0f));
+
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+
+    return _mm256_andnot_ps(underflow, _mm256_mul_ps(p, _mm256_castsi256_ps(bits)));
+}
+
+KERNELS_AVX2 float _dot_avx2(const float *a, const float *b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+
+    float sum = _hsum_avx2(_mm256_add_ps(acc0, acc1));
+
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
+
+KERNELS_AVX2 void _axpy_avx2(size_t n, float alpha, const float *x, float *y) {
+    __m256 va = _mm256_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+
+    for (; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+void _gemv_avx2(size_t m, size_t n, const float *a, const float *x, float *y) {
+    _gemv_rows(m, n, a, x, y, _dot_avx2);
+}
+
+void _gemm_avx2(size_t m, size_t n, size_t k, const float *a, size_t a_row_stride, size_t a_col_stride, const float *b, float *c) {
+    _gemm_blocked(m, n, k, a, a_row_stride, a_col_stride, b, c, _axpy_avx2);
+}
+
+KERNELS_AVX2 void _exp_avx2(const float *x, float *y, size_t n) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _exp_avx2_ps(_mm256_loadu_ps(x + i)));
+    }
+
+    for (; i < n; i++) {
+        y[i] = expf_approx(x[i]);
+    }
+}
+
+KERNELS_AVX2 void _sigmoid_avx2(const float *x, float *y, size_t n) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 e = _exp_avx2_ps(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(x + i)));
+        _mm256_storeu_ps(y + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+    }
+
+    for (; i < n; i++) {
+        y[i] = 1.0f / (1.0f + expf_approx(-x[i]));
+    }
+}
+
+KERNELS_AVX2 void _relu_avx2(const float *x, float *y, size_t n) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_max_ps(_mm256_loadu_ps(x + i), _mm256_setzero_ps()));
+    }
+
+    for (; i < n; i++) {
+        y[i] = x[i] > 0 ? x[i] : 0;
+    }
+}
+
+KERNELS_AVX2 float _sum_avx2(const float *x, size_t n) {
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_loadu_ps(x + i));
+    }
+
+    float sum = _hsum_avx2(acc);
+
+    for (; i < n; i++) {
+        sum += x[i];
+    }
+
+    return sum;
+}
+
+KERNELS_AVX2 float _max_avx2(const float *x, size_t n) {
+    __m256 best = _mm256_set1_ps(-INFINITY);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        best = _mm256_max_ps(best, _mm256_loadu_ps(x + i));
+    }
+
+    __m128 low = _mm_max_ps(_mm256_castps256_ps128(best), _mm256_extractf128_ps(best, 1));
+
+    low = _mm_max_ps(low, _mm_movehl_ps(low, low));
+    low = _mm_max_ss(low, _mm_shuffle_ps(low, low, 1));
+
+    float result = _mm_cvtss_f32(low);
+
+    for (; i < n; i++) {
+        result = x[i] > result ? x[i] : result;
+    }
+
+    return result;
+}
+
+KERNELS_AVX2 int32_t _dot_s8_avx2(const int8_t *a, const int8_t *b, size_t n) {
+    // Same widening multiply-add as SSE4.2, 16 bytes per step
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (b + i)));
+
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+
+    __m128i low = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+    low = _mm_add_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+    low = _mm_add_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    int32_t sum = _mm_cvtsi128_si32(low);
+
+    for (; i < n; i++) {
+        sum += (int32_t) a[i] * b[i];
+    }
+
+    return sum;
+}
+
+// AVX-512F: 16 lanes, unmasked main loops and one masked load and store for the tail
+
+#define KERNELS_AVX512 __attribute__((target("avx512f")))
+
+KERNELS_AVX512 __mmask16 _tail_mask(size_t remaining) {
+    return remaining >= 16 ? (__mmask16) 0xffff : (__mmask16) ((1u << remaining) - 1);
+}
+
+KERNELS_AVX512 __m512 _exp_avx512_ps(__m512 x) {
+    __mmask16 underflow = _mm512_cmp_ps_mask(x, _mm512_set1_ps(KERNELS_EXP_MIN), _CMP_LT_OQ);
+
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(KERNELS_EXP_MIN)), _mm512_set1_ps(KERNELS_EXP_MAX));
+
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fmadd_ps(n, _mm512_set1_ps(2.12194440e-4f), r);
+
+    __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.3981999507e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(8.3334519073e-3f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(4.1665795894e-2f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.6666665459e-1f));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(5.0000001201e-1f));
+    p = _mm512_add_ps(_mm512_fmadd_ps(_mm512_mul_ps(p, r), r, r), _mm512_set1_ps(1.0f));
+
+    __m512i bits = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+
+    return _mm512_mask_mov_ps(_mm512_mul_ps(p, _mm512_castsi512_ps(bits)), underflow, _mm512_setzero_ps());
+}
+
+KERNELS_AVX512 float _dot_avx512(const float *a, const float *b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+
+    if (i < n) {
+        __mmask16 mask = _tail_mask(n - i);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+KERNELS_AVX512 void _axpy_avx512(size_t n, float alpha, const float *x, float *y) {
+    __m512 va = _mm512_set1_ps(alpha);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+    }
+
+    if (i < n) {
+        __mmask16 mask = _tail_mask(n - i);
+        __m512 vy = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i));
+
+        _mm512_mask_storeu_ps(y + i, mask, vy);
+    }
+}
+
+void _gemv_avx512(size_t m, size_t n, const float *a, const float *x, float *y) {
+    _gemv_rows(m, n, a, x, y, _dot_avx512);
+}
+
+KERNELS_AVX512 void _exp_avx512(const float *x, float *y, size_t n) {
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _exp_avx512_ps(_mm512_loadu_ps(x + i)));
+    }
+
+    if (i < n) {
+        __mmask16 mask = _tail_mask(n - i);
+        _mm512_mask_storeu_ps(y + i, mask, _exp_avx512_ps(_mm512_maskz_loadu_ps(mask, x + i)));
+    }
+}
+
+KERNELS_AVX512 __m512 _sigmoid_avx512_ps(__m512 x) {
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 e = _exp_avx512_ps(_mm512_sub_ps(_mm512_setzero_ps(), x));
+
+    return _mm512_div_ps(one, _mm512_add_ps(one, e));
+}
+
+KERNELS_AVX512 void _sigmoid_avx512(const float *x, float *y, size_t n) {
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _sigmoid_avx512_ps(_mm512_loadu_ps(x + i)));
+    }
+
+    if (i < n) {
+        __mmask16 mask = _tail_mask(n - i);
+        _mm512_mask_storeu_ps(y + i, mask, _sigmoid_avx512_ps(_mm512_maskz_loadu_ps(mask, x + i)));
+    }
+}
+
+KERNELS_AVX512 void _relu_avx512(const float *x, float *y, size_t n) {
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_max_ps(_mm512_loadu_ps(x + i), _mm512_setzero_ps()));
+    }
+
+    if (i < n) {
+        __mmask16 mask = _tail_mask(n - i);
+        _mm512_mask_storeu_ps(y + i, mask, _mm512_max_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_setzero_ps()));
+    }
+}
+
+KERNELS_AVX512 float _sum_avx512(const float *x, size_t n) {
+    __m512 acc = _mm512_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        acc = _mm512_add_ps(acc, _mm512_loadu_ps(x + i));
+    }
+
+    if (i < n) {
+        acc = _mm512_add_ps(acc, _mm512_maskz_loadu_ps(_tail_mask(n - i), x + i));
+    }
+
+    return _mm512_reduce_add_ps(acc);
+}
+
+KERNELS_AVX512 float _max_avx512(const float *x, size_t n) {
+    __m512 best = _mm512_set1_ps(-INFINITY);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        best = _mm512_max_ps(best, _mm512_loadu_ps(x + i));
+    }
+
+    if (i < n) {
+        __mmask16 mask = _tail_mask(n - i);
+        best = _mm512_mask_max_ps(best, mask, best, _mm512_maskz_loadu_ps(mask, x + i));
+    }
+
+    return _mm512_reduce_max_ps(best);
+}
+
+#endif // KERNELS_X86
+
+KernelBackend _kernel_backends[KERNEL_COUNT] = {
+    [KERNEL_SCALAR] = { "scalar", _dot_scalar, _axpy_scalar, _gemv_scalar, gemm_nn, _exp_scalar, _sigmoid_scalar, _relu_scalar, _sum_scalar, _max_scalar, _dot_s8_scalar },
+#ifdef KERNELS_X86
+    [KERNEL_SSE42] = { "sse4.2", _dot_sse42, _axpy_sse42, _gemv_sse42, _gemm_sse42, _exp_sse42, _sigmoid_sse42, _relu_sse42, _sum_sse42, _max_sse42, _dot_s8_sse42 },
+    [KERNEL_AVX2] = { "avx2", _dot_avx2, _axpy_avx2, _gemv_avx2, _gemm_avx2, _exp_avx2, _sigmoid_avx2, _relu_avx2, _sum_avx2, _max_avx2, _dot_s8_avx2 },
+    // The blocked GEMM is bound by the loads and stores of C, and measured no faster with 16 lanes than with
+    // 8 (kernels-check), so AVX-512 keeps the AVX2 GEMM and only widens the compute-bound kernels.
+    // Byte and word arithmetic is AVX-512BW, which is not checked for, so the int8 dot stays AVX2 too
+    [KERNEL_AVX512] = { "avx512", _dot_avx512, _axpy_avx512, _gemv_avx512, _gemm_avx2, _exp_avx512, _sigmoid_avx512, _relu_avx512, _sum_avx512, _max_avx512, _dot_s8_avx2 },
+#endif
+};
+
+bool kernels_supported(KERNEL_ISA isa) {
+    if (isa == KERNEL_SCALAR) return true;
+
+#ifdef KERNELS_X86
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+
+    bool sse42 = ecx & (1u << 20);
+    bool fma = ecx & (1u << 12);
+    bool osxsave = ecx & (1u << 27);
+    bool avx = ecx & (1u << 28);
+
+    if (isa == KERNEL_SSE42) return sse42;
+    if (!osxsave || !avx) return false;
+
+    // The OS must save the wider registers on a context switch: XMM and YMM state, plus the opmask and
+    // ZMM state for AVX-512
+    uint32_t xcr0_low, xcr0_high;
+    __asm__ volatile ("xgetbv" : "=a" (xcr0_low), "=d" (xcr0_high) : "c" (0));
+
+    if ((xcr0_low & 0x6) != 0x6) return false;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+
+    bool avx2 = ebx & (1u << 5);
+    bool avx512f = ebx & (1u << 16);
+
+    if (isa == KERNEL_AVX2) return avx2 && fma;
+    if (isa == KERNEL_AVX512) return avx512f && (xcr0_low & 0xe6) == 0xe6;
+#endif
+
+    return false;
+}
+
+KernelBackend *kernels_backend(KERNEL_ISA isa) {
+    return kernels_supported(isa) ? &_kernel_backends[isa] : NULL;
+}
+
+bool kernels_use(KERNEL_ISA isa) {
+    // Force a backend, e.g. to compare against the scalar reference; false if this CPU cannot run it
+    KernelBackend *backend = kernels_backend(isa);
+
+    if (backend) atomic_store(&_kernels_active, backend);
+
+    return backend != NULL;
+}
+
+KernelBackend *kernels(void) {
+    // Racing first calls all pick the same backend; the atomic pointer makes publishing it well defined
+    KernelBackend *active = atomic_load(&_kernels_active);
+
+    if (active) return active;
+
+    KernelBackend *best = &_kernel_backends[KERNEL_SCALAR];
+
+    for (int isa = KERNEL_COUNT - 1; isa > KERNEL_SCALAR; isa--) {
+        if (kernels_supported((KERNEL_ISA) isa)) {
+            best = &_kernel_backends[isa];
+            break;
+        }
+    }
+
+    atomic_store(&_kernels_active, best);
+
+    return best;
+}
+
+void kernels_gemm_nt(size_t m, size_t n, size_t k, const float *a, const float *b, float *c) {
+    // C[m x n] += A[m x k] * B[n x k]^T with the active backend's dot product
+    KernelBackend *backend = kernels();
+
+    for (size_t jj = 0; jj < n; jj += GEMM_BLOCK_M) {
+        size_t j_end = jj + GEMM_BLOCK_M < n ? jj + GEMM_BLOCK_M : n;
+
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = jj; j < j_end; j++) {
+                c[i * n + j] += backend->dot(a + i * k, b + j * k, k);
+            }
+        }
+    }
+}
+
+void kernels_gemm_s8_nt(size_t m, size_t n, size_t k, const int8_t *a, const int8_t *b, int32_t *c) {
+    // C[m x n] += A[m x k] * B[n x k]^T on int8, exact in 32 bits while k stays below 2^31 / 127^2
+    KernelBackend *backend = kernels();
+
+    for (size_t jj = 0; jj < n; jj += GEMM_BLOCK_M) {
+        size_t j_end = jj + GEMM_BLOCK_M < n ? jj + GEMM_BLOCK_M : n;
+
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = jj; j < j_end; j++) {
+                c[i * n + j] += backend->dot_s8(a + i * k, b + j * k, k);
+            }
+        }
+    }
+}
+
+#endif // KERNELS_H
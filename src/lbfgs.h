@@ -0,0 +1,463 @@
+#ifndef LBFGS_H
+#define LBFGS_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "arena.h"
+#include "exec.h"
+#include "kernels.h"
+#include "micrograd.h"
+#include "pool.h"
+
+typedef enum {
+    LBFGS_RUNNING,
+    LBFGS_CONVERGED,            // The gradient or the loss decrease fell below its tolerance
+    LBFGS_MAX_ITERATIONS,
+    LBFGS_LINE_SEARCH_FAILED    // No step satisfying the Wolfe conditions, even along the steepest descent
+} LBFGS_STATUS;
+
+// Zeroed fields take the defaults in brackets
+typedef struct {
+    size_t  history;                // Curvature pairs kept [10]
+    size_t  max_iterations;         // [100]
+    size_t  max_line_search;        // Loss evaluations per line search [20]
+    float   gradient_tolerance;     // Stop once no gradient component is larger [1e-5]
+    float   loss_tolerance;         // Stop once an iteration improves the loss by a smaller fraction [1e-7]
+    float   c1;                     // Sufficient decrease [1e-4]
+    float   c2;                     // Curvature [0.9]
+    size_t  block_size;             // Examples per task [256]
+    size_t  num_workers;            // [1]
+} LBFGSConfig;
+
+// Full-batch L-BFGS over the trainable parameters of an ExecModel. Examples are the rows of a
+// contiguous float matrix, one column per model input (targets included), and the loss is the mean
+// of the root over all of them. Blocks of examples are evaluated in parallel, each on a worker's
+// context; the block sums are reduced in block order, so results do not depend on the thread count.
+typedef struct {
+    LBFGSConfig     config;
+    ExecModel       *model;
+    ExecContext     **contexts;
+    ThreadPool      *pool;
+
+    const float     *examples;
+    size_t          num_examples;
+    size_t          num_blocks;
+    double          *block_losses;
+    float           *block_grads;       // num_blocks x num_params
+
+    size_t          num_params;
+    float           *x;                 // Parameters, gradient and search direction at the current point
+    float           *g;
+    float           *d;
+    float           *x_new;             // The line search's latest point
+    float           *g_new;
+    float           *s;                 // Ring of curvature pairs: s = x_new - x, y = g_new - g
+    float           *y;
+    float           *rho;
+    float           *alpha;
+    size_t          num_pairs;
+    size_t          next_pair;
+
+    float           loss;
+    float           gradient_norm;
+    size_t          iterations;
+    size_t          evaluations;
+    LBFGS_STATUS    status;
+    bool            started;
+} LBFGS;
+
+// Header
+
+LBFGS *lbfgs_create(Arena *arena, ExecModel *model, const float *examples, size_t num_examples, LBFGSConfig config);
+void lbfgs_destroy(LBFGS *lbfgs);
+float lbfgs_evaluate(LBFGS *lbfgs, const float *x, float *gradient);
+LBFGS_STATUS lbfgs_step(LBFGS *lbfgs);
+LBFGS_STATUS lbfgs_minimize(LBFGS *lbfgs);
+const char *lbfgs_status_name(LBFGS_STATUS status);
+
+void _lbfgs_task(void *context, size_t begin, size_t end, size_t worker);
+void _lbfgs_set_params(LBFGS *lbfgs, const float *x);
+void _lbfgs_direction(LBFGS *lbfgs);
+float _lbfgs_trial(LBFGS *lbfgs, float step, float *slope);
+float _lbfgs_interpolate(float a_lo, float f_lo, float d_lo, float a_hi, float f_hi, float d_hi);
+bool _lbfgs_line_search(LBFGS *lbfgs, float initial_step);
+float _lbfgs_max_norm(const float *v, size_t n);
+
+// Implementation
+
+LBFGS *lbfgs_create(Arena *arena, ExecModel *model, const float *examples, size_t num_examples, LBFGSConfig config) {
+    LBFGS *lbfgs = (LBFGS *) arena_allocate(arena, sizeof(LBFGS));
+
+    if (config.history == 0) config.history = 10;
+    if (config.max_iterations == 0) config.max_iterations = 100;
+    if (config.max_line_search == 0) config.max_line_search = 20;
+    if (config.gradient_tolerance == 0) config.gradient_tolerance = 1e-5f;
+    if (config.loss_tolerance == 0) config.loss_tolerance = 1e-7f;
+    if (config.c1 == 0) config.c1 = 1e-4f;
+    if (config.c2 == 0) config.c2 = 0.9f;
+    if (config.block_size == 0) config.block_size = 256;
+    if (config.num_workers == 0) config.num_workers = 1;
+
+    size_t n = model->num_params;
+
+    *lbfgs = (LBFGS) {
+        .config = config,
+        .model = model,
+        .pool = pool_create(config.num_workers),
+        .examples = examples,
+        .num_examples = num_examples,
+        .num_blocks = (num_examples + config.block_size - 1) / config.block_size,
+        .num_params = n,
+        .status = LBFGS_RUNNING
+    };
+
+    lbfgs->contexts = (ExecContext **) arena_allocate(arena, sizeof(ExecContext *) * config.num_workers);
+
+    for (size_t w = 0; w < config.num_workers; w++) {
+        lbfgs->contexts[w] = exec_context_create(arena, model);
+    }
+
+    lbfgs->block_losses = (double *) arena_allocate(arena, sizeof(double) * (lbfgs->num_blocks + 1));
+    lbfgs->block_grads = (float *) arena_allocate(arena, sizeof(float) * (lbfgs->num_blocks * n + 1));
+
+    lbfgs->x = (float *) arena_allocate(arena, sizeof(float) * (n + 1));
+    lbfgs->g = (float *) arena_allocate(arena, sizeof(float) * (n + 1));
+    lbfgs->d = (float *) arena_allocate(arena, sizeof(float) * (n + 1));
+    lbfgs->x_new = (float *) arena_allocate(arena, sizeof(float) * (n + 1));
+    lbfgs->g_new = (float *) arena_allocate(arena, sizeof(float) * (n + 1));
+    lbfgs->s = (float *) arena_allocate(arena, sizeof(float) * (config.history * n + 1));
+    lbfgs->y = (float *) arena_allocate(arena, sizeof(float) * (config.history * n + 1));
+    lbfgs->rho = (float *) arena_allocate(arena, sizeof(float) * config.history);
+    lbfgs->alpha = (float *) arena_allocate(arena, sizeof(float) * config.history);
+
+    for (size_t p = 0; p < n; p++) {
+        lbfgs->x[p] = model->params[p]->data;
+    }
+
+    return lbfgs;
+}
+
+void lbfgs_destroy(LBFGS *lbfgs) {
+    pool_destroy(lbfgs->pool);
+    lbfgs->pool = NULL;
+}
+
+const char *lbfgs_status_name(LBFGS_STATUS status) {
+    switch (status) {
+        case LBFGS_RUNNING:             return "running";
+        case LBFGS_CONVERGED:           return "converged";
+        case LBFGS_MAX_ITERATIONS:      return "max iterations";
+        case LBFGS_LINE_SEARCH_FAILED:  return "line search failed";
+    }
+
+    return "unknown";
+}
+
+void _lbfgs_set_params(LBFGS *lbfgs, const float *x) {
+    // Contexts read parameters in place, so this must only run between evaluations
+    for (size_t p = 0; p < lbfgs->num_params; p++) {
+        lbfgs->model->params[p]->data = x[p];
+    }
+}
+
+void _lbfgs_task(void *context, size_t begin, size_t end, size_t worker) {
+    LBFGS *lbfgs = (LBFGS *) context;
+
+    assert(worker < lbfgs->config.num_workers);
+
+    ExecContext *ctx = lbfgs->contexts[worker];
+    size_t num_inputs = lbfgs->model->num_inputs;
+
+    for (size_t b = begin; b < end; b++) {
+        size_t first = b * lbfgs->config.block_size;
+        size_t last = first + lbfgs->config.block_size < lbfgs->num_examples ? first + lbfgs->config.block_size : lbfgs->num_examples;
+        float *grads = lbfgs->block_grads + b * lbfgs->num_params;
+        double loss = 0;
+
+        exec_zero_grad(ctx);
+
+        for (size_t i = first; i < last; i++) {
+            exec_forward(ctx, lbfgs->examples + i * num_inputs);
+            exec_backward(ctx);
+            loss += exec_loss(ctx);
+        }
+
+        for (size_t p = 0; p < lbfgs->num_params; p++) {
+            grads[p] = exec_param_grad(ctx, p);
+        }
+
+        lbfgs->block_losses[b] = loss;
+    }
+}
+
+float lbfgs_evaluate(LBFGS *lbfgs, const float *x, float *gradient) {
+    // Mean loss and gradient over every example at x; the model's parameters are left at x
+    KernelBackend *k = kernels();
+    double loss = 0;
+
+    _lbfgs_set_params(lbfgs, x);
+    pool_parallel_for(lbfgs->pool, 0, lbfgs->num_blocks, 1, _lbfgs_task, lbfgs);
+
+    memset(gradient, 0, sizeof(float) * lbfgs->num_params);
+
+    for (size_t b = 0; b < lbfgs->num_blocks; b++) {
+        loss += lbfgs->block_losses[b];
+        k->axpy(lbfgs->num_params, 1.0f, lbfgs->block_grads + b * lbfgs->num_params, gradient);
+    }
+
+    for (size_t p = 0; p < lbfgs->num_params; p++) {
+        gradient[p] /= (float) lbfgs->num_examples;
+    }
+
+    lbfgs->evaluations += 1;
+
+    return (float) (loss / (double) lbfgs->num_examples);
+}
+
+float _lbfgs_max_norm(const float *v, size_t n) {
+    float norm = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        norm = fabsf(v[i]) > norm ? fabsf(v[i]) : norm;
+    }
+
+    return norm;
+}
+
+void _lbfgs_direction(LBFGS *lbfgs) {
+    // Two-loop recursion: d = -H g, with H0 scaled by the newest pair's s.y / y.y
+    KernelBackend *k = kernels();
+    size_t n = lbfgs->num_params;
+    size_t m = lbfgs->config.history;
+    float *d = lbfgs->d;
+
+    for (size_t p = 0; p < n; p++) {
+        d[p] = -lbfgs->g[p];
+    }
+
+    for (size_t i = 0; i < lbfgs->num_pairs; i++) {
+        size_t j = (lbfgs->next_pair + m - 1 - i) % m;
+
+        lbfgs->alpha[j] = lbfgs->rho[j] * k->dot(lbfgs->s + j * n, d, n);
+        k->axpy(n, -lbfgs->alpha[j], lbfgs->y + j * n, d);
+    }
+
+    if (lbfgs->num_pairs > 0) {
+        size_t newest = (lbfgs->next_pair + m - 1) % m;
+        float *y = lbfgs->y + newest * n;
+        float gamma = 1.0f / (lbfgs->rho[newest] * k->dot(y, y, n));
+
+        for (size_t p = 0; p < n; p++) {
+            d[p] *= gamma;
+        }
+    }
+
+    for (size_t i = lbfgs->num_pairs; i > 0; i--) {
+        size_t j = (lbfgs->next_pair + m - i) % m;
+        float beta = lbfgs->rho[j] * k->dot(lbfgs->y + j * n, d, n);
+
+        k->axpy(n, lbfgs->alpha[j] - beta, lbfgs->s + j * n, d);
+    }
+}
+
+float _lbfgs_trial(LBFGS *lbfgs, float step, float *slope) {
+    // Evaluates x + step * d into x_new and g_new, returning the loss and its slope along d
+    memcpy(lbfgs->x_new, lbfgs->x, sizeof(float) * lbfgs->num_params);
+    kernels()->axpy(lbfgs->num_params, step, lbfgs->d, lbfgs->x_new);
+
+    float loss = lbfgs_evaluate(lbfgs, lbfgs->x_new, lbfgs->g_new);
+
+    *slope = kernels()->dot(lbfgs->g_new, lbfgs->d, lbfgs->num_params);
+
+    return loss;
+}
+
+float _lbfgs_interpolate(float a_lo, float f_lo, float d_lo, float a_hi, float f_hi, float d_hi) {
+    // Minimiser of the cubic through both ends, kept away from them; bisection when it is unusable
+    float width = a_hi - a_lo;
+    float d1 = d_lo + d_hi - 3 * (f_lo - f_hi) / (a_lo - a_hi);
+    float radicand = d1 * d1 - d_lo * d_hi;
+    float middle = a_lo + width / 2;
+
+    if (radicand < 0 || !isfinite(radicand)) return middle;
+
+    float d2 = copysignf(sqrtf(radicand), width);
+    float a = a_hi - width * (d_hi + d2 - d1) / (d_hi - d_lo + 2 * d2);
+
+    float low = a_lo + 0.1f * width;
+    float high = a_hi - 0.1f * width;
+
+    if (!isfinite(a) || (a - low) * (a - high) > 0) return middle;
+
+    return a;
+}
+
+bool _lbfgs_line_search(LBFGS *lbfgs, float initial_step) {
+    // Strong Wolfe line search (Nocedal and Wright, algorithms 3.5 and 3.6). On success x_new, g_new
+    // and new_loss hold the accepted point, which is also the last one evaluated.
+    LBFGSConfig *config = &lbfgs->config;
+    float f0 = lbfgs->loss;
+    float slope0 = kernels()->dot(lbfgs->g, lbfgs->d, lbfgs->num_params);
+
+    float a_prev = 0, f_prev = f0, d_prev = slope0;
+    float a = initial_step;
+    float a_lo = 0, f_lo = 0, d_lo = 0;
+    float a_hi = 0, f_hi = 0, d_hi = 0;
+    bool bracketed = false;
+
+    for (size_t e = 0; e < config->max_line_search; e++) {
+        if (bracketed) a = _lbfgs_interpolate(a_lo, f_lo, d_lo, a_hi, f_hi, d_hi);
+
+        float slope;
+        float f = _lbfgs_trial(lbfgs, a, &slope);
+
+        if (!isfinite(f)) {
+            // Stepped somewhere the loss blows up: shrink towards the last good point. Once bracketed,
+            // the infinite end makes the interpolation fall back to bisection.
+            if (bracketed) a_hi = a, f_hi = INFINITY, d_hi = 0;
+            else a = a_prev + (a - a_prev) / 4;
+
+            continue;
+        }
+
+        bool sufficient = f <= f0 + config->c1 * a * slope0;
+
+        if (!bracketed) {
+            if (!sufficient || (e > 0 && f >= f_prev)) {
+                bracketed = true;
+                a_lo = a_prev, f_lo = f_prev, d_lo = d_prev;
+                a_hi = a, f_hi = f, d_hi = slope;
+                continue;
+            }
+
+            if (fabsf(slope) <= -config->c2 * slope0) {
+                lbfgs->loss = f;
+                return true;
+            }
+
+            if (slope >= 0) {
+                bracketed = true;
+                a_lo = a, f_lo = f, d_lo = slope;
+                a_hi = a_prev, f_hi = f_prev, d_hi = d_prev;
+                continue;
+            }
+
+            a_prev = a, f_prev = f, d_prev = slope;
+            a *= 2;
+            continue;
+        }
+
+        if (!sufficient || f >= f_lo) {
+            a_hi = a, f_hi = f, d_hi = slope;
+            continue;
+        }
+
+        if (fabsf(slope) <= -config->c2 * slope0) {
+            lbfgs->loss = f;
+            return true;
+        }
+
+        if (slope * (a_hi - a_lo) >= 0) {
+            a_hi = a_lo, f_hi = f_lo, d_hi = d_lo;
+        }
+
+        a_lo = a, f_lo = f, d_lo = slope;
+    }
+
+    return false;
+}
+
+LBFGS_STATUS lbfgs_step(LBFGS *lbfgs) {
+    // One iteration: a search direction from the history, a line search along it and a history update.
+    // The model's parameters are left at the new point.
+    KernelBackend *k = kernels();
+    size_t n = lbfgs->num_params;
+    size_t m = lbfgs->config.history;
+
+    if (lbfgs->status != LBFGS_RUNNING) return lbfgs->status;
+
+    if (!lbfgs->started) {
+        lbfgs->loss = lbfgs_evaluate(lbfgs, lbfgs->x, lbfgs->g);
+        lbfgs->gradient_norm = _lbfgs_max_norm(lbfgs->g, n);
+        lbfgs->started = true;
+    }
+
+    if (lbfgs->gradient_norm <= lbfgs->config.gradient_tolerance) return lbfgs->status = LBFGS_CONVERGED;
+    if (lbfgs->iterations >= lbfgs->config.max_iterations) return lbfgs->status = LBFGS_MAX_ITERATIONS;
+
+    _lbfgs_direction(lbfgs);
+
+    if (k->dot(lbfgs->g, lbfgs->d, n) >= 0) {
+        // Not a descent direction (only possible through rounding): restart along the gradient
+        lbfgs->num_pairs = 0;
+        lbfgs->next_pair = 0;
+        _lbfgs_direction(lbfgs);
+    }
+
+    // Without curvature information the first step is scaled to move the parameters by about one unit
+    float initial_step = 1;
+
+    if (lbfgs->num_pairs == 0) {
+        float norm = sqrtf(k->dot(lbfgs->g, lbfgs->g, n));
+
+        initial_step = norm > 1 ? 1 / norm : 1;
+    }
+
+    float previous_loss = lbfgs->loss;
+
+    if (!_lbfgs_line_search(lbfgs, initial_step)) {
+        if (lbfgs->num_pairs == 0) {
+            _lbfgs_set_params(lbfgs, lbfgs->x);
+            return lbfgs->status = LBFGS_LINE_SEARCH_FAILED;
+        }
+
+        // A stale history can give a poor direction; forget it and retry along the gradient next time
+        lbfgs->num_pairs = 0;
+        lbfgs->next_pair = 0;
+        _lbfgs_set_params(lbfgs, lbfgs->x);
+        return lbfgs->status;
+    }
+
+    float *s = lbfgs->s + lbfgs->next_pair * n;
+    float *y = lbfgs->y + lbfgs->next_pair * n;
+
+    for (size_t p = 0; p < n; p++) {
+        s[p] = lbfgs->x_new[p] - lbfgs->x[p];
+        y[p] = lbfgs->g_new[p] - lbfgs->g[p];
+    }
+
+    // Pairs without positive curvature would make H indefinite
+    float sy = k->dot(s, y, n);
+
+    if (sy > 1e-10f * k->dot(y, y, n)) {
+        lbfgs->rho[lbfgs->next_pair] = 1 / sy;
+        lbfgs->next_pair = (lbfgs->next_pair + 1) % m;
+        lbfgs->num_pairs += lbfgs->num_pairs < m ? 1 : 0;
+    }
+
+    memcpy(lbfgs->x, lbfgs->x_new, sizeof(float) * n);
+    memcpy(lbfgs->g, lbfgs->g_new, sizeof(float) * n);
+
+    lbfgs->gradient_norm = _lbfgs_max_norm(lbfgs->g, n);
+    lbfgs->iterations += 1;
+
+    float scale = fmaxf(fmaxf(fabsf(previous_loss), fabsf(lbfgs->loss)), 1);
+
+    if (lbfgs->gradient_norm <= lbfgs->config.gradient_tolerance) return lbfgs->status = LBFGS_CONVERGED;
+    if (previous_loss - lbfgs->loss <= lbfgs->config.loss_tolerance * scale) return lbfgs->status = LBFGS_CONVERGED;
+
+    return lbfgs->status;
+}
+
+LBFGS_STATUS lbfgs_minimize(LBFGS *lbfgs) {
+    while (lbfgs_step(lbfgs) == LBFGS_RUNNING);
+
+    return lbfgs->status;
+}
+
+#endif // LBFGS_H
@@ -0,0 +1,73 @@
+/*
+
+The linear regression example fitted with full-batch L-BFGS: one loss and gradient evaluation over a
+fixed dataset per line search step, instead of 10000 single-example SGD steps
+
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "exec.h"
+#include "lbfgs.h"
+#include "micrograd.h"
+
+#define NUM_EXAMPLES    10000
+#define NUM_WORKERS     4
+
+float compute_y(float x1, float x2) {
+    float noise = float_create_random() / (float) 10;
+    float true_w1 = 3;
+    float true_w2 = -1;
+    float true_b = -2;
+
+    return true_w1 * x1 + true_w2 * x2 + true_b + noise;
+}
+
+int main(void) {
+    rng_set_seed((uint64_t) time(NULL));
+
+    Arena *arena = arena_create(1000000);
+
+    // Inputs in the order of the example matrix's columns
+    Value **inputs = inputs_create(arena, 3);
+    Value *x1 = inputs[0];
+    Value *x2 = inputs[1];
+    Value *y = inputs[2];
+
+    Value *w1 = value_create_random(arena);
+    Value *w2 = value_create_random(arena);
+    Value *b = value_create_random(arena);
+
+    Value *y_pred = op_add(arena, op_add(arena, op_mul(arena, w1, x1), op_mul(arena, w2, x2)), b);
+    Value *loss = loss_mean_squared_error(arena, y, y_pred);
+
+    Graph *graph = graph_create(arena, loss, 20);
+    ExecModel *model = exec_model_create(arena, graph, inputs, 3, &y_pred, 1);
+
+    float *examples = (float *) arena_allocate(arena, sizeof(float) * NUM_EXAMPLES * 3);
+
+    for (size_t i = 0; i < NUM_EXAMPLES; i++) {
+        examples[i * 3] = float_create_random();
+        examples[i * 3 + 1] = float_create_random();
+        examples[i * 3 + 2] = compute_y(examples[i * 3], examples[i * 3 + 1]);
+    }
+
+    LBFGS *lbfgs = lbfgs_create(arena, model, examples, NUM_EXAMPLES, (LBFGSConfig) {
+        .num_workers = NUM_WORKERS
+    });
+
+    lbfgs_minimize(lbfgs);
+
+    printf("Stopped (%s) after %zu iterations and %zu evaluations, Loss: %f\n",
+        lbfgs_status_name(lbfgs->status), lbfgs->iterations, lbfgs->evaluations, lbfgs->loss);
+
+    printf("Learned w1: %f, True w1: %f\n", w1->data, 3.f);
+    printf("Learned w2: %f, True w2: %f\n", w2->data, -1.f);
+    printf("Learned b: %f, True b: %f\n", b->data, -2.f);
+
+    lbfgs_destroy(lbfgs);
+    arena_destroy(arena);
+    return 0;
+}
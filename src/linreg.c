@@ -14,7 +14,7 @@ float compute_y(float x1, float x2) {
 }
 
 int main(void) {
-    srand(time(NULL));
+    rng_set_seed((uint64_t) time(NULL));
 
     Arena *arena = arena_create(2048);
 
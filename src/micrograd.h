@@ -2,10 +2,13 @@
 #define MICROGRAD_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <math.h>
 
 #include "arena.h"
+#include "random.h"
 
 #define EPSILON     0.01
 
@@ -16,6 +19,12 @@ typedef enum {
     ACT_SOFTMAX
 } ACTIVATION;
 
+typedef enum {
+    INIT_UNIFORM,   // Uniform in [0, 0.2), the original initialisation
+    INIT_XAVIER,    // Uniform in +-sqrt(6 / (fan_in + fan_out)), zero bias
+    INIT_HE         // Normal with std sqrt(2 / fan_in), zero bias
+} INITIALIZER;
+
 typedef struct Value Value;
 
 struct Value {
@@ -26,6 +35,10 @@ struct Value {
     size_t  num_children;
     Value   **children;
     bool    not_trainable;
+    bool    grad_in_state;  // Backward adds to its own slot of its child's state, never to the child's grad
+
+    void    *state;         // Op-specific bytes, e.g. the nonzero inputs seen by a sparse dot product
+    size_t  state_size;     // graph_clone copies state byte for byte, so it must not hold pointers
 
     void    (*forward)  (Value *self);
     void    (*backward) (Value *self);
@@ -36,18 +49,41 @@ typedef struct {
     size_t  num_values;
 } Graph;
 
+// Open-addressing hash map from a Value to its position, e.g. in a Graph
+typedef struct {
+    Value   **keys;
+    size_t  *indices;
+    size_t  capacity;
+    size_t  count;
+} ValueMap;
+
+// Where layer_create put the parameters of a dense layer, so callers can walk them by neuron
+typedef struct {
+    Value       **weights;      // num_neurons rows of num_inputs
+    Value       **biases;       // One per neuron
+    size_t      num_inputs;
+    size_t      num_neurons;
+    ACTIVATION  activation;
+} Layer;
+
 typedef struct {
     size_t      num_inputs;
     size_t      num_layers;
     size_t      *num_neurons;
     ACTIVATION  hidden_activation;
     ACTIVATION  output_activation;
+    INITIALIZER initializer;
+    bool        sparse_inputs;  // First layer skips inputs that are exactly zero; the inputs must be constants
+    Rng         *rng;           // Draws the initial weights [rng_thread()]
+    Layer       *layers;        // Receives num_layers records [NULL]
 } NetworkConfig;
 
 // Header
 
 Value *value_create_constant(Arena *arena, float data);
+Value *value_create_parameter(Arena *arena, float data);
 Value *value_create_random(Arena *arena);
+bool value_is_constant(Value *value);
 
 void op_add_forward(Value *self);
 void op_add_backward(Value *self);
@@ -59,6 +95,8 @@ void op_sigmoid_forward(Value *self);
 void op_sigmoid_backward(Value *self);
 void op_clip_forward(Value *self);
 void op_clip_backward(Value *self);
+void op_dot_sparse_forward(Value *self);
+void op_dot_sparse_backward(Value *self);
 
 Value *op_add(Arena *arena, Value *a, Value *b);
 Value *op_mul(Arena *arena, Value *a, Value *b);
@@ -66,11 +104,20 @@ Value *op_relu(Arena *arena, Value *a);
 Value *op_sigmoid(Arena *arena, Value *a);
 Value *op_negate(Arena *arena, Value *a);
 Value *op_clip(Arena *arena, Value *a);
+Value *op_dot_sparse(Arena *arena, Value **weights, Value **inputs, size_t num_inputs);
 
 Value *loss_mean_squared_error(Arena *arena, Value *y_true, Value *y_pred);
 
-void _graph_create(Arena *arena, Value *root, Value **visited, size_t *count);
+ValueMap *value_map_create(size_t max_values);
+void value_map_destroy(ValueMap *map);
+bool value_map_insert(ValueMap *map, Value *value, size_t index);
+size_t value_map_find(ValueMap *map, Value *value);
+ValueMap *graph_index_create(Graph *graph);
+
+void _graph_create(Value *root, ValueMap *visited, Value **order, size_t *count, size_t max_values);
 Graph *graph_create(Arena *arena, Value *root, size_t max_values);
+Graph *graph_clone(Arena *arena, Graph *graph, Value **handles, Value **cloned_handles, size_t num_handles);
+Graph *graph_relayout(Arena *arena, Graph *graph, Value **handles, size_t num_handles);
 void graph_forward(Graph *graph);
 void graph_backward(Graph *graph);
 void graph_update(Graph *graph, float learning_rate);
@@ -78,14 +125,19 @@ void graph_zero_grad(Graph *graph);
 void graph_optimisation_step(Graph *graph, float learning_rate);
 
 Value **inputs_create(Arena *arena, size_t num_inputs);
+void inputs_set_sparse(Value **inputs, size_t num_inputs, const size_t *indices, const float *values, size_t num_nonzero);
+Value *_sum_create(Arena *arena, Value **terms, size_t num_terms);
 Value *neuron_create(Arena *arena, Value **inputs, size_t num_inputs, ACTIVATION activation);
-Value **layer_create(Arena *arena, Value **inputs, size_t num_inputs, size_t num_neurons, ACTIVATION activation);
+Value *_neuron_create(Arena *arena, Value **inputs, size_t num_inputs, Value **weights, Value *bias, ACTIVATION activation, bool sparse);
+Value *neuron_create_initialized(Arena *arena, Value **inputs, size_t num_inputs, const float *weights, float bias_data, ACTIVATION activation, bool sparse);
+Value **layer_create(Arena *arena, Value **inputs, size_t num_inputs, size_t num_neurons, ACTIVATION activation, INITIALIZER initializer, bool sparse, Rng *rng, Layer *layer);
 Value **network_create(Arena *arena, Value **inputs, NetworkConfig config);
 
 void value_print(Value *value);
 void graph_print(Graph *graph);
 float float_create_random(void);
 float float_sigmoid(float x);
+void weights_initialize(float *weights, size_t num_weights, size_t fan_in, size_t fan_out, INITIALIZER initializer, Rng *rng);
 
 // Implementation
 
@@ -101,24 +153,34 @@ Value *value_create_constant(Arena *arena, float data) {
     return value;
 }
 
-Value *value_create_random(Arena *arena) {
+Value *value_create_parameter(Arena *arena, float data) {
     Value *value = (Value *) arena_allocate(arena, sizeof(Value));
 
     *value = (Value) {
         .repr = 'v',
-        .data = float_create_random()
+        .data = data
     };
 
     return value;
 }
 
+Value *value_create_random(Arena *arena) {
+    return value_create_parameter(arena, float_create_random());
+}
+
+bool value_is_constant(Value *value) {
+    return value->not_trainable && !value->backward;
+}
+
 void op_add_forward(Value *self) {
     self->data = self->children[0]->data + self->children[1]->data;
 }
 
 void op_add_backward(Value *self) {
-    self->children[0]->grad += self->grad;
-    self->children[1]->grad += self->grad;
+    // Nothing reads the gradient of a constant, so it is never written and values sharing one can run
+    // their backward concurrently
+    if (!value_is_constant(self->children[0])) self->children[0]->grad += self->grad;
+    if (!value_is_constant(self->children[1])) self->children[1]->grad += self->grad;
 }
 
 void op_mul_forward(Value *self) {
@@ -126,8 +188,8 @@ void op_mul_forward(Value *self) {
 }
 
 void op_mul_backward(Value *self) {
-    self->children[0]->grad += self->children[1]->data * self->grad;
-    self->children[1]->grad += self->children[0]->data * self->grad;
+    if (!value_is_constant(self->children[0])) self->children[0]->grad += self->children[1]->data * self->grad;
+    if (!value_is_constant(self->children[1])) self->children[1]->grad += self->children[0]->data * self->grad;
 }
 
 void op_relu_forward(Value *self) {
@@ -143,9 +205,9 @@ void op_sigmoid_forward(Value *self) {
 }
 
 void op_sigmoid_backward(Value *self) {
-    float x = self->children[0]->data;
+    float s = float_sigmoid(self->children[0]->data);
 
-    self->children[0]->grad += (self->grad * float_sigmoid(x) / (1.0f - float_sigmoid(x) + EPSILON));
+    self->children[0]->grad += self->grad * s * (1.0f - s);
 }
 
 void op_clip_forward(Value *self) {
@@ -157,6 +219,37 @@ void op_clip_backward(Value *self) {
     self->children[0]->grad += self->grad;
 }
 
+void op_dot_sparse_forward(Value *self) {
+    // Children are [weights..., inputs...]; the positions of the nonzero inputs are kept for backward
+    size_t num_inputs = self->num_children / 2;
+    uint32_t *nonzero = (uint32_t *) self->state;
+    uint32_t num_nonzero = 0;
+    float sum = 0;
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        float x = self->children[num_inputs + i]->data;
+
+        if (x != 0) {
+            nonzero[1 + num_nonzero++] = (uint32_t) i;
+            sum += self->children[i]->data * x;
+        }
+    }
+
+    nonzero[0] = num_nonzero;
+    self->data = sum;
+}
+
+void op_dot_sparse_backward(Value *self) {
+    // Only weight gradients: op_dot_sparse only accepts constant inputs, whose gradients are never used
+    size_t num_inputs = self->num_children / 2;
+    uint32_t *nonzero = (uint32_t *) self->state;
+
+    for (uint32_t k = 0; k < nonzero[0]; k++) {
+        uint32_t i = nonzero[1 + k];
+        self->children[i]->grad += self->children[num_inputs + i]->data * self->grad;
+    }
+}
+
 Value *op_add(Arena *arena, Value *a, Value *b) {
     Value *value = (Value *) arena_allocate(arena, sizeof(Value));
     Value **children = (Value **) arena_allocate(arena, sizeof(Value *) * 2);
@@ -250,6 +343,34 @@ Value *op_clip(Arena *arena, Value *a) {
     return value;
 }
 
+Value *op_dot_sparse(Arena *arena, Value **weights, Value **inputs, size_t num_inputs) {
+    Value *value = (Value *) arena_allocate(arena, sizeof(Value));
+    Value **children = (Value **) arena_allocate(arena, sizeof(Value *) * 2 * num_inputs);
+    size_t state_size = sizeof(uint32_t) * (num_inputs + 1);
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        // Backward skips the inputs, so a computed or trainable input would silently get no gradient
+        assert(value_is_constant(inputs[i]));
+
+        children[i] = weights[i];
+        children[num_inputs + i] = inputs[i];
+    }
+
+    *value = (Value) {
+        .repr = 'd',
+        .num_children = 2 * num_inputs,
+        .children = children,
+        .state = arena_allocate(arena, state_size),
+        .state_size = state_size,
+        .forward = op_dot_sparse_forward,
+        .backward = op_dot_sparse_backward
+    };
+
+    *(uint32_t *) value->state = 0;
+
+    return value;
+}
+
 Value *loss_mean_squared_error(Arena *arena, Value *y_true, Value *y_pred) {
     Value *half = value_create_constant(arena, 0.5);
 
@@ -262,32 +383,98 @@ Value *loss_mean_squared_error(Arena *arena, Value *y_true, Value *y_pred) {
     return loss;
 }
 
-void _graph_create(Arena *arena, Value *root, Value **visited, size_t *count) {
-    if (!root) return;
+ValueMap *value_map_create(size_t max_values) {
+    ValueMap *map = (ValueMap *) calloc(1, sizeof(ValueMap));
+    size_t capacity = 16;
+
+    // Keep the load factor at or below one half
+    while (capacity < 2 * max_values) capacity *= 2;
+
+    map->keys = (Value **) calloc(capacity, sizeof(Value *));
+    map->indices = (size_t *) calloc(capacity, sizeof(size_t));
+    map->capacity = capacity;
+    map->count = 0;
 
-    for (size_t i = 0; i < *count; i++) {
-        if (root == visited[i]) return;
+    return map;
+}
+
+void value_map_destroy(ValueMap *map) {
+    free(map->keys);
+    map->keys = NULL;
+    free(map->indices);
+    map->indices = NULL;
+    free(map);
+    map = NULL;
+}
+
+bool value_map_insert(ValueMap *map, Value *value, size_t index) {
+    assert(2 * (map->count + 1) <= map->capacity);
+
+    size_t slot = ((uintptr_t) value >> 4) * 0x9e3779b97f4a7c15ull & (map->capacity - 1);
+
+    while (map->keys[slot]) {
+        if (map->keys[slot] == value) return false;
+
+        slot = (slot + 1) & (map->capacity - 1);
     }
 
-    visited[*count] = root;
-    *count += 1;
+    map->keys[slot] = value;
+    map->indices[slot] = index;
+    map->count += 1;
+
+    return true;
+}
+
+size_t value_map_find(ValueMap *map, Value *value) {
+    size_t slot = ((uintptr_t) value >> 4) * 0x9e3779b97f4a7c15ull & (map->capacity - 1);
+
+    while (map->keys[slot]) {
+        if (map->keys[slot] == value) return map->indices[slot];
+
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+
+    return SIZE_MAX;
+}
+
+ValueMap *graph_index_create(Graph *graph) {
+    ValueMap *map = value_map_create(graph->num_values);
+
+    for (size_t i = 0; i < graph->num_values; i++) {
+        value_map_insert(map, graph->values[i], i);
+    }
+
+    return map;
+}
+
+void _graph_create(Value *root, ValueMap *visited, Value **order, size_t *count, size_t max_values) {
+    if (!root) return;
+    if (!value_map_insert(visited, root, 0)) return;
 
     for (size_t i = 0; i < root->num_children; i++) {
-        _graph_create(arena, root->children[i], visited, count);
+        _graph_create(root->children[i], visited, order, count, max_values);
     }
+
+    // Post-order: a value is appended only after everything it depends on
+    assert(*count < max_values);
+
+    order[*count] = root;
+    *count += 1;
 }
 
 Graph *graph_create(Arena *arena, Value *root, size_t max_values) {
-    Value **visited = (Value **) calloc(max_values, sizeof(Value *));
+    ValueMap *visited = value_map_create(max_values);
+    Value **order = (Value **) calloc(max_values, sizeof(Value *));
     size_t count = 0;
 
-    _graph_create(arena, root, visited, &count);
+    _graph_create(root, visited, order, &count, max_values);
 
     Graph *value_graph = (Graph *) arena_allocate(arena, sizeof(Graph));
     Value **values = (Value **) arena_allocate(arena, sizeof(Value *) * count);
 
+    // Reverse so the root comes first and every value comes before its children
     for (size_t i = 0; i < count; i++) {
-        values[i] = visited[i];
+        values[i] = order[count - 1 - i];
     }
 
     *value_graph = (Graph) {
@@ -295,12 +482,77 @@ Graph *graph_create(Arena *arena, Value *root, size_t max_values) {
         .num_values = count
     };
 
-    free(visited);
+    value_map_destroy(visited);
     visited = NULL;
+    free(order);
+    order = NULL;
 
     return value_graph;
 }
 
+Graph *graph_clone(Arena *arena, Graph *graph, Value **handles, Value **cloned_handles, size_t num_handles) {
+    // Deep copy into `arena`; cloned_handles[i] is the copy of handles[i], or NULL if it is not in the graph.
+    // Each value is laid out in execution order followed by its children array and its state, so the
+    // forward pass streams through memory and backward streams through it in reverse.
+    ValueMap *index = graph_index_create(graph);
+    Value **values = (Value **) arena_allocate(arena, sizeof(Value *) * graph->num_values);
+
+    // Children run first, so they have always been copied by the time their parents are
+    for (size_t i = graph->num_values; i > 0; i--) {
+        Value *value = graph->values[i - 1];
+        Value *copy = (Value *) arena_allocate(arena, sizeof(Value));
+
+        *copy = *value;
+        values[i - 1] = copy;
+
+        if (value->num_children > 0) {
+            copy->children = (Value **) arena_allocate(arena, sizeof(Value *) * value->num_children);
+
+            for (size_t j = 0; j < value->num_children; j++) {
+                copy->children[j] = values[value_map_find(index, value->children[j])];
+            }
+        }
+
+        if (value->state_size > 0) {
+            copy->state = arena_allocate(arena, value->state_size);
+            memcpy(copy->state, value->state, value->state_size);
+        }
+    }
+
+    for (size_t i = 0; i < num_handles; i++) {
+        size_t handle_index = value_map_find(index, handles[i]);
+        cloned_handles[i] = handle_index == SIZE_MAX ? NULL : values[handle_index];
+    }
+
+    Graph *clone = (Graph *) arena_allocate(arena, sizeof(Graph));
+
+    *clone = (Graph) {
+        .values = values,
+        .num_values = graph->num_values
+    };
+
+    value_map_destroy(index);
+    index = NULL;
+
+    return clone;
+}
+
+Graph *graph_relayout(Arena *arena, Graph *graph, Value **handles, size_t num_handles) {
+    // graph_clone, with the caller's handles (inputs, labels, outputs...) remapped in place. Handles that
+    // are not in the graph are left as they are. The old values stay where they were but are no longer used.
+    Value **cloned_handles = (Value **) calloc(num_handles + 1, sizeof(Value *));
+    Graph *relayout = graph_clone(arena, graph, handles, cloned_handles, num_handles);
+
+    for (size_t i = 0; i < num_handles; i++) {
+        if (cloned_handles[i]) handles[i] = cloned_handles[i];
+    }
+
+    free(cloned_handles);
+    cloned_handles = NULL;
+
+    return relayout;
+}
+
 void graph_forward(Graph *graph) {
     for (size_t i = graph->num_values; i > 0; i--) {
         if (graph->values[i - 1]->forward) {
@@ -354,14 +606,57 @@ Value **inputs_create(Arena *arena, size_t num_inputs) {
     return inputs;
 }
 
+void inputs_set_sparse(Value **inputs, size_t num_inputs, const size_t *indices, const float *values, size_t num_nonzero) {
+    // Fill inputs from (index, value) pairs; every other input is zero
+    for (size_t i = 0; i < num_inputs; i++) {
+        inputs[i]->data = 0;
+    }
+
+    for (size_t k = 0; k < num_nonzero; k++) {
+        assert(indices[k] < num_inputs);
+        inputs[indices[k]]->data = values[k];
+    }
+}
+
+Value *_sum_create(Arena *arena, Value **terms, size_t num_terms) {
+    // Pairwise sum, so the graph is log2(num_terms) additions deep instead of num_terms
+    if (num_terms == 1) return terms[0];
+
+    size_t half = num_terms / 2;
+
+    return op_add(arena, _sum_create(arena, terms, half), _sum_create(arena, terms + half, num_terms - half));
+}
+
 Value *neuron_create(Arena *arena, Value **inputs, size_t num_inputs, ACTIVATION activation) {
-    Value *bias = value_create_random(arena);
-    bias->repr = 'b';
+    float *weights = (float *) calloc(num_inputs + 1, sizeof(float));
 
-    for (size_t i = 0; i < num_inputs; i++) {
-        Value *weight = value_create_random(arena);
-        weight->repr = 'w';
-        bias = op_add(arena, bias, op_mul(arena, weight, inputs[i]));
+    weights_initialize(weights, num_inputs + 1, num_inputs, 1, INIT_UNIFORM, rng_thread());
+
+    Value *neuron = neuron_create_initialized(arena, inputs, num_inputs, weights, weights[num_inputs], activation, false);
+
+    free(weights);
+    weights = NULL;
+
+    return neuron;
+}
+
+Value *_neuron_create(Arena *arena, Value **inputs, size_t num_inputs, Value **weights, Value *bias, ACTIVATION activation, bool sparse) {
+    if (num_inputs > 0) {
+        if (sparse) {
+            bias = op_add(arena, bias, op_dot_sparse(arena, weights, inputs, num_inputs));
+        }
+        else {
+            Value **products = (Value **) calloc(num_inputs, sizeof(Value *));
+
+            for (size_t i = 0; i < num_inputs; i++) {
+                products[i] = op_mul(arena, weights[i], inputs[i]);
+            }
+
+            bias = op_add(arena, bias, _sum_create(arena, products, num_inputs));
+
+            free(products);
+            products = NULL;
+        }
     }
 
     if (activation == ACT_RELU) {
@@ -374,19 +669,64 @@ Value *neuron_create(Arena *arena, Value **inputs, size_t num_inputs, ACTIVATION
     return bias;
 }
 
-Value **layer_create(Arena *arena, Value **inputs, size_t num_inputs, size_t num_neurons, ACTIVATION activation) {
+Value *neuron_create_initialized(Arena *arena, Value **inputs, size_t num_inputs, const float *weights, float bias_data, ACTIVATION activation, bool sparse) {
+    Value *bias = value_create_parameter(arena, bias_data);
+    bias->repr = 'b';
+
+    Value **parameters = (Value **) arena_allocate(arena, sizeof(Value *) * num_inputs);
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        parameters[i] = value_create_parameter(arena, weights[i]);
+        parameters[i]->repr = 'w';
+    }
+
+    return _neuron_create(arena, inputs, num_inputs, parameters, bias, activation, sparse);
+}
+
+Value **layer_create(Arena *arena, Value **inputs, size_t num_inputs, size_t num_neurons, ACTIVATION activation, INITIALIZER initializer, bool sparse, Rng *rng, Layer *layer) {
     Value **neurons = (Value **) arena_allocate(arena, sizeof(Value *) * num_neurons);
 
+    // Draw the whole layer at once: num_inputs weights per neuron followed by one bias per neuron
+    size_t num_weights = num_inputs * num_neurons;
+    float *weights = (float *) calloc(num_weights + num_neurons, sizeof(float));
+
+    weights_initialize(weights, num_weights, num_inputs, num_neurons, initializer, rng);
+
+    if (initializer == INIT_UNIFORM) {
+        weights_initialize(weights + num_weights, num_neurons, num_inputs, num_neurons, INIT_UNIFORM, rng);
+    }
+
+    Value **parameters = (Value **) arena_allocate(arena, sizeof(Value *) * (num_weights + num_neurons));
+
+    for (size_t i = 0; i < num_weights + num_neurons; i++) {
+        parameters[i] = value_create_parameter(arena, weights[i]);
+        parameters[i]->repr = i < num_weights ? 'w' : 'b';
+    }
+
     for (size_t i = 0; i < num_neurons; i++) {
-        neurons[i] = neuron_create(arena, inputs, num_inputs, activation);
+        neurons[i] = _neuron_create(arena, inputs, num_inputs, parameters + i * num_inputs, parameters[num_weights + i], activation, sparse);
     }
 
+    if (layer) {
+        *layer = (Layer) {
+            .weights = parameters,
+            .biases = parameters + num_weights,
+            .num_inputs = num_inputs,
+            .num_neurons = num_neurons,
+            .activation = activation
+        };
+    }
+
+    free(weights);
+    weights = NULL;
+
     return neurons;
 }
 
 Value **network_create(Arena *arena, Value **inputs, NetworkConfig config) {
     Value **outputs = inputs;
     size_t num_inputs = config.num_inputs;
+    Rng *rng = config.rng ? config.rng : rng_thread();
 
     for (size_t i = 0; i < config.num_layers; i++) {
         bool is_output_layer = i == config.num_layers - 1;
@@ -394,7 +734,8 @@ Value **network_create(Arena *arena, Value **inputs, NetworkConfig config) {
 
         printf("Creating layer with %zu inputs and %zu outputs\n", num_inputs, config.num_neurons[i]);
 
-        outputs = layer_create(arena, outputs, num_inputs, config.num_neurons[i], activation);
+        // Only the first layer reads the raw inputs
+        outputs = layer_create(arena, outputs, num_inputs, config.num_neurons[i], activation, config.initializer, config.sparse_inputs && i == 0, rng, config.layers ? &config.layers[i] : NULL);
         num_inputs = config.num_neurons[i];
     }
 
@@ -416,11 +757,26 @@ void graph_print(Graph *graph) {
 }
 
 float float_create_random(void) {
-    return (float) rand() * 0.2f / (float) RAND_MAX;
+    return rng_uniform(rng_thread()) * 0.2f;
 }
 
 float float_sigmoid(float x) {
     return 1.0f / (1.0f + expf(-1.0f * x));
 }
 
+void weights_initialize(float *weights, size_t num_weights, size_t fan_in, size_t fan_out, INITIALIZER initializer, Rng *rng) {
+    RngBulk bulk = rng_bulk_create(rng);
+
+    if (initializer == INIT_XAVIER) {
+        float limit = sqrtf(6.0f / (float) (fan_in + fan_out));
+        rng_bulk_fill_uniform(&bulk, weights, num_weights, -limit, limit);
+    }
+    else if (initializer == INIT_HE) {
+        rng_bulk_fill_normal(&bulk, weights, num_weights, 0, sqrtf(2.0f / (float) fan_in));
+    }
+    else {
+        rng_bulk_fill_uniform(&bulk, weights, num_weights, 0, 0.2f);
+    }
+}
+
 #endif // MICROGRAD_H
@@ -0,0 +1,121 @@
+/*
+
+Send concurrent inference requests for MNIST test images to mnist-server
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "mnist.h"
+#include "server.h"
+
+#define SOCKET_PATH             "/tmp/micrograd.sock"
+#define NUM_CLIENTS             16
+#define REQUESTS_PER_CLIENT     1000
+
+typedef struct {
+    size_t              client_id;
+    MNISTData           *data;
+    size_t              num_correct;
+    size_t              num_failed;
+    LatencyHistogram    latency;
+} ClientState;
+
+void *run_client(void *arg) {
+    ClientState *state = (ClientState *) arg;
+    MNISTData *data = state->data;
+    size_t input_dim = data->num_rows * data->num_cols;
+    float *pixels = (float *) calloc(input_dim, sizeof(float));
+    float prediction = 0;
+
+    int fd = -1;
+
+    for (size_t i = 0; i < REQUESTS_PER_CLIENT; i++) {
+        size_t index = (state->client_id * REQUESTS_PER_CLIENT + i) % data->num_items;
+
+        // A failed request can leave a partial message on the socket, so every failure reconnects, and
+        // the client gives up on the rest once the server stops accepting connections
+        if (fd < 0) fd = client_connect(SOCKET_PATH);
+
+        if (fd < 0) {
+            state->num_failed += REQUESTS_PER_CLIENT - i;
+            break;
+        }
+
+        get_example(data, index, pixels);
+
+        uint64_t start_ns = time_now_ns();
+
+        if (!client_infer(fd, (uint32_t) i, pixels, (uint32_t) input_dim, &prediction, 1)) {
+            state->num_failed += 1;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+
+        latency_record(&state->latency, time_now_ns() - start_ns);
+
+        uint8_t predicted_label = prediction < 0.5 ? 0 : 1;
+        state->num_correct += predicted_label == data->labels[index];
+    }
+
+    if (fd >= 0) close(fd);
+
+    free(pixels);
+    pixels = NULL;
+
+    return NULL;
+}
+
+int main(void) {
+    Arena *arena = arena_create(20000000);
+
+    MNISTData *test_data = load_dataset(arena, NUM_TEST_EXAMPLES, TEST_IMAGES_FILEPATH, TEST_LABELS_FILEPATH);
+    MNISTData *data = get_zeros_and_ones(arena, test_data);
+
+    pthread_t threads[NUM_CLIENTS];
+    ClientState states[NUM_CLIENTS] = { };
+
+    uint64_t start_ns = time_now_ns();
+
+    for (size_t i = 0; i < NUM_CLIENTS; i++) {
+        states[i] = (ClientState) {
+            .client_id = i,
+            .data = data
+        };
+
+        pthread_create(&threads[i], NULL, run_client, &states[i]);
+    }
+
+    LatencyHistogram latency = { };
+    size_t num_correct = 0;
+    size_t num_failed = 0;
+
+    for (size_t i = 0; i < NUM_CLIENTS; i++) {
+        pthread_join(threads[i], NULL);
+
+        latency_merge(&latency, &states[i].latency);
+        num_correct += states[i].num_correct;
+        num_failed += states[i].num_failed;
+    }
+
+    float elapsed_s = (float) (time_now_ns() - start_ns) / 1e9f;
+
+    printf("Requests: %llu, Failed: %zu, Accuracy: %f\n", (unsigned long long) latency.total, num_failed, latency.total ? (float) num_correct / (float) latency.total : 0);
+    printf("Throughput: %.0f requests/s\n", (float) latency.total / elapsed_s);
+    printf("Client latency p50: %.0f us, p99: %.0f us\n", latency_percentile(&latency, 0.5f), latency_percentile(&latency, 0.99f));
+
+    int fd = client_connect(SOCKET_PATH);
+
+    if (fd >= 0) {
+        client_shutdown(fd);
+        close(fd);
+    }
+
+    arena_destroy(arena);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+
+Train a small convolutional network on the MNIST 0s and 1s and evaluate it on the test set
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "conv.h"
+#include "eval.h"
+#include "micrograd.h"
+#include "mnist.h"
+#include "timing.h"
+
+#define NUM_FILTERS     4
+#define NUM_EPOCHS      1
+#define EVAL_THREADS    4
+
+int main(void) {
+    rng_set_seed((uint64_t) time(NULL));
+
+    Arena *arena = arena_create(400000000);
+    size_t input_dim = IMAGE_HEIGHT * IMAGE_WIDTH;
+
+    MNISTData *train_data = get_zeros_and_ones(arena, load_dataset(arena, NUM_TRAIN_EXAMPLES, TRAIN_IMAGES_FILEPATH, TRAIN_LABELS_FILEPATH));
+    MNISTData *test_data = get_zeros_and_ones(arena, load_dataset(arena, NUM_TEST_EXAMPLES, TEST_IMAGES_FILEPATH, TEST_LABELS_FILEPATH));
+
+    // 1x28x28 -> conv 3x3 -> 4x28x28 -> relu -> max pool 2x2 -> 4x14x14 -> flatten -> sigmoid
+    Value **inputs = inputs_create(arena, input_dim);
+    Value *y = value_create_constant(arena, 0);
+
+    Conv2dConfig conv_config = {
+        .out_channels = NUM_FILTERS,
+        .kernel_size = 3,
+        .stride = 1,
+        .padding = 1,
+        .initializer = INIT_HE
+    };
+
+    Tensor image = tensor_create(inputs, 1, IMAGE_HEIGHT, IMAGE_WIDTH);
+    Tensor features = tensor_activate(arena, op_conv2d(arena, image, conv_config), ACT_RELU);
+    Tensor pooled = op_maxpool2d(arena, features, 2, 2);
+
+    size_t num_features;
+    Value **flat = op_flatten(pooled, &num_features);
+    Value **outputs = layer_create(arena, flat, num_features, 1, ACT_SIGMOID, INIT_XAVIER, false, rng_thread(), NULL);
+    Value *loss = loss_mean_squared_error(arena, y, outputs[0]);
+    Graph *graph = graph_create(arena, loss, 1000000);
+
+    printf("Graph has %zu values, %zu features after pooling\n", graph->num_values, num_features);
+
+    Sampler *sampler = sampler_create(arena, train_data->num_items, rng_thread());
+    float *pixels = (float *) calloc(input_dim, sizeof(float));
+    float learning_rate = 0.01;
+
+    for (size_t epoch = 0; epoch < NUM_EPOCHS; epoch++) {
+        float epoch_loss = 0;
+        double start = time_now_seconds();
+
+        for (size_t i = 0; i < train_data->num_items; i++) {
+            size_t index = sampler_next(sampler);
+
+            get_example(train_data, index, pixels);
+
+            for (size_t j = 0; j < input_dim; j++) {
+                inputs[j]->data = pixels[j];
+            }
+
+            y->data = (float) train_data->labels[index];
+
+            graph_optimisation_step(graph, learning_rate);
+
+            epoch_loss += graph->values[0]->data;
+        }
+
+        double seconds = time_now_seconds() - start;
+
+        printf("Epoch: %4zu, Loss: %f, Step time: %.3f ms\n", epoch + 1, epoch_loss / train_data->num_items, seconds * 1e3 / train_data->num_items);
+    }
+
+    Evaluator *evaluator = evaluator_create(arena, graph, inputs, input_dim, y, outputs, 1, EVAL_THREADS);
+
+    evaluator_snapshot(evaluator);
+
+    EvalResult result = evaluator_run(evaluator, test_data);
+    eval_result_print(&result, evaluator->num_classes);
+
+    evaluator_destroy(evaluator);
+
+    free(pixels);
+    pixels = NULL;
+
+    arena_destroy(arena);
+    return 0;
+}
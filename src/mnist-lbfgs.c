@@ -0,0 +1,94 @@
+/*
+
+Train the MNIST 0 vs 1 logistic regression with full-batch L-BFGS instead of per-example SGD. Every
+iteration evaluates the loss and gradient over the whole training set in parallel
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "eval.h"
+#include "exec.h"
+#include "lbfgs.h"
+#include "micrograd.h"
+#include "mnist.h"
+#include "timing.h"
+
+#define NUM_WORKERS     4
+
+int main(void) {
+    rng_set_seed((uint64_t) time(NULL));
+
+    Arena *arena = arena_create(200000000);
+    size_t input_dim = IMAGE_HEIGHT * IMAGE_WIDTH;
+
+    printf("Loading data\n");
+
+    MNISTData *train_data = load_dataset(arena, NUM_TRAIN_EXAMPLES, TRAIN_IMAGES_FILEPATH, TRAIN_LABELS_FILEPATH);
+    MNISTData *data = get_zeros_and_ones(arena, train_data);
+    MNISTData *test_data = load_dataset(arena, NUM_TEST_EXAMPLES, TEST_IMAGES_FILEPATH, TEST_LABELS_FILEPATH);
+    MNISTData *eval_data = get_zeros_and_ones(arena, test_data);
+
+    printf("Creating model\n");
+
+    // The label is the model's last input, so one row of the example matrix holds a whole example
+    Value **inputs = inputs_create(arena, input_dim + 1);
+    Value *y = inputs[input_dim];
+
+    NetworkConfig config = {
+        .num_inputs = input_dim,
+        .num_layers = 1,
+        .num_neurons = (size_t[]) { 1 },
+        .output_activation = ACT_SIGMOID,
+        .initializer = INIT_XAVIER,
+        .sparse_inputs = true
+    };
+
+    Value **outputs = network_create(arena, inputs, config);
+    Value *loss = loss_mean_squared_error(arena, y, outputs[0]);
+    Graph *graph = graph_create(arena, loss, 400000);
+    ExecModel *model = exec_model_create(arena, graph, inputs, input_dim + 1, outputs, 1);
+
+    float *examples = (float *) arena_allocate(arena, sizeof(float) * data->num_items * (input_dim + 1));
+
+    for (size_t i = 0; i < data->num_items; i++) {
+        float *row = examples + i * (input_dim + 1);
+
+        get_example(data, i, row);
+        row[input_dim] = (float) data->labels[i];
+    }
+
+    LBFGS *lbfgs = lbfgs_create(arena, model, examples, data->num_items, (LBFGSConfig) {
+        .history = 10,
+        .max_iterations = 50,
+        .gradient_tolerance = 1e-6f,
+        .num_workers = NUM_WORKERS
+    });
+
+    printf("Starting training.. %zu parameters, %u examples per evaluation\n", model->num_params, data->num_items);
+
+    double start = time_now_seconds();
+
+    while (lbfgs_step(lbfgs) == LBFGS_RUNNING) {
+        printf("Iteration: %3zu, Evaluations: %3zu, Loss: %f, Max gradient: %e\n", lbfgs->iterations, lbfgs->evaluations, lbfgs->loss, lbfgs->gradient_norm);
+    }
+
+    printf("Stopped (%s) after %zu iterations and %zu evaluations in %.2fs, Loss: %f\n",
+        lbfgs_status_name(lbfgs->status), lbfgs->iterations, lbfgs->evaluations, time_now_seconds() - start, lbfgs->loss);
+
+    // The graph's parameters now hold the solution
+    Evaluator *evaluator = evaluator_create(arena, graph, inputs, input_dim, y, outputs, 1, NUM_WORKERS);
+
+    evaluator_snapshot(evaluator);
+    EvalResult eval_result = evaluator_run(evaluator, eval_data);
+    eval_result_print(&eval_result, evaluator->num_classes);
+
+    evaluator_destroy(evaluator);
+    lbfgs_destroy(lbfgs);
+    arena_destroy(arena);
+    return 0;
+}
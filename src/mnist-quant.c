@@ -0,0 +1,134 @@
+/*
+
+Measure the accuracy cost of bf16, fp16 and int8 weights and int8 activations against the fp32 MNIST
+model. Each mode builds an inference model that holds its weights only in that format; with int8
+activations the layers run on the int8 GEMM
+
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "mnist.h"
+#include "quantize.h"
+
+#define NUM_CALIBRATION_SAMPLES 500
+
+typedef struct {
+    const char          *name;
+    PRECISION           precision;
+    QUANT_GRANULARITY   granularity;
+    bool                int8_activations;
+} QuantMode;
+
+void train(Arena *arena, Graph *graph, Layer *layers, size_t num_layers, PRECISION precision, Value **inputs, Value *y, MNISTData *data, float learning_rate) {
+    // One epoch; in bf16 or fp16 the weights stay on that format's grid throughout training
+    Sampler *sampler = sampler_create(arena, data->num_items, rng_thread());
+    size_t num_pixels = data->num_rows * data->num_cols;
+    float *pixels = (float *) calloc(num_pixels, sizeof(float));
+    float epoch_loss = 0;
+
+    for (size_t i = 0; i < data->num_items; i++) {
+        size_t index = sampler_next(sampler);
+
+        get_example(data, index, pixels);
+
+        for (size_t j = 0; j < num_pixels; j++) {
+            inputs[j]->data = pixels[j];
+        }
+
+        y->data = (float) data->labels[index];
+
+        if (precision != PRECISION_FP32) graph_optimisation_step_reduced(graph, layers, num_layers, precision, learning_rate);
+        else graph_optimisation_step(graph, learning_rate);
+
+        epoch_loss += graph->values[0]->data;
+    }
+
+    printf("Loss: %f\n", epoch_loss / data->num_items);
+
+    free(pixels);
+    pixels = NULL;
+}
+
+int main(void) {
+    rng_set_seed((uint64_t) time(NULL));
+
+    Arena *arena = arena_create(100000000);
+    size_t input_dim = IMAGE_HEIGHT * IMAGE_WIDTH;
+
+    MNISTData *train_data = get_zeros_and_ones(arena, load_dataset(arena, NUM_TRAIN_EXAMPLES, TRAIN_IMAGES_FILEPATH, TRAIN_LABELS_FILEPATH));
+    MNISTData *test_data = get_zeros_and_ones(arena, load_dataset(arena, NUM_TEST_EXAMPLES, TEST_IMAGES_FILEPATH, TEST_LABELS_FILEPATH));
+
+    Value **inputs = inputs_create(arena, input_dim);
+    Value *y = value_create_constant(arena, 0);
+    Layer layers[1];
+
+    NetworkConfig config = {
+        .num_inputs = input_dim,
+        .num_layers = 1,
+        .num_neurons = (size_t[]) { 1 },
+        .output_activation = ACT_SIGMOID,
+        .initializer = INIT_XAVIER,
+        .layers = layers
+    };
+
+    Value *y_pred = network_create(arena, inputs, config)[0];
+    Graph *graph = graph_create(arena, loss_mean_squared_error(arena, y, y_pred), 400000);
+    float learning_rate = 0.0003;
+
+    printf("Training fp32 model\n");
+    train(arena, graph, layers, config.num_layers, PRECISION_FP32, inputs, y, train_data, learning_rate);
+
+    float fp32_accuracy = accuracy_mnist(quant_model_create(arena, layers, config.num_layers, PRECISION_FP32, QUANT_PER_TENSOR), test_data);
+
+    QuantMode modes[] = {
+        { "fp32",                       PRECISION_FP32, QUANT_PER_TENSOR,   false },
+        { "bf16",                       PRECISION_BF16, QUANT_PER_TENSOR,   false },
+        { "fp16",                       PRECISION_FP16, QUANT_PER_TENSOR,   false },
+        { "int8 per-tensor",            PRECISION_INT8, QUANT_PER_TENSOR,   false },
+        { "int8 per-channel",           PRECISION_INT8, QUANT_PER_CHANNEL,  false },
+        { "int8 per-channel + acts",    PRECISION_INT8, QUANT_PER_CHANNEL,  true }
+    };
+
+    printf("===== Post-training quantization (%u test examples) =====\n", test_data->num_items);
+    printf("%-26s %10s %10s %10s\n", "Mode", "Bytes", "Accuracy", "Delta");
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        QuantModel *model = quant_model_create(arena, layers, config.num_layers, modes[i].precision, modes[i].granularity);
+
+        if (modes[i].int8_activations) calibration_run_mnist(model, train_data, NUM_CALIBRATION_SAMPLES);
+
+        float accuracy = accuracy_mnist(model, test_data);
+
+        printf("%-26s %10zu %10.4f %+10.4f\n", modes[i].name, quant_model_bytes(model), accuracy, accuracy - fp32_accuracy);
+    }
+
+    printf("===========================\n");
+
+    // Retrain from scratch with weights kept in bf16 and fp32 gradient accumulation
+    printf("Training bf16 model\n");
+
+    Layer bf16_layers[1];
+    Value **bf16_inputs = inputs_create(arena, input_dim);
+    Value *bf16_y = value_create_constant(arena, 0);
+
+    config.layers = bf16_layers;
+
+    Value *bf16_y_pred = network_create(arena, bf16_inputs, config)[0];
+    Graph *bf16_graph = graph_create(arena, loss_mean_squared_error(arena, bf16_y, bf16_y_pred), 400000);
+
+    layers_round(bf16_layers, config.num_layers, PRECISION_BF16);
+    train(arena, bf16_graph, bf16_layers, config.num_layers, PRECISION_BF16, bf16_inputs, bf16_y, train_data, learning_rate);
+
+    // The trained weights are already on the bf16 grid, so the bf16 model holds them exactly
+    QuantModel *bf16 = quant_model_create(arena, bf16_layers, config.num_layers, PRECISION_BF16, QUANT_PER_TENSOR);
+    float bf16_accuracy = accuracy_mnist(bf16, test_data);
+
+    printf("bf16-trained accuracy: %.4f (%+.4f vs fp32), parameters: %zu bytes\n", bf16_accuracy, bf16_accuracy - fp32_accuracy, quant_model_bytes(bf16));
+
+    arena_destroy(arena);
+    return 0;
+}
@@ -0,0 +1,95 @@
+/*
+
+Train the MNIST logistic regression model and serve it over a Unix domain socket
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "mnist.h"
+#include "server.h"
+
+#define SOCKET_PATH         "/tmp/micrograd.sock"
+#define MAX_BATCH_SIZE      32
+#define MAX_WAIT_US         500
+#define MAX_CONNECTIONS     64
+#define SERVER_WORKERS      4
+
+int main(void) {
+    rng_set_seed((uint64_t) time(NULL));
+
+    Arena *arena = arena_create(100000000);
+    size_t input_dim = IMAGE_HEIGHT * IMAGE_WIDTH;
+
+    printf("Loading data\n");
+
+    MNISTData *train_data = load_dataset(arena, NUM_TRAIN_EXAMPLES, TRAIN_IMAGES_FILEPATH, TRAIN_LABELS_FILEPATH);
+    MNISTData *data = get_zeros_and_ones(arena, train_data);
+
+    printf("Creating model\n");
+
+    Value **inputs = inputs_create(arena, input_dim);
+    Value *y = value_create_constant(arena, 0);
+
+    NetworkConfig config = {
+        .num_inputs = input_dim,
+        .num_layers = 1,
+        .num_neurons = (size_t[]) { 1 },
+        .output_activation = ACT_SIGMOID,
+        .initializer = INIT_XAVIER
+    };
+
+    Value **outputs = network_create(arena, inputs, config);
+    Value *loss = loss_mean_squared_error(arena, y, outputs[0]);
+
+    Graph *graph = graph_create(arena, loss, 400000);
+    float *pixels = (float *) arena_allocate(arena, sizeof(float) * input_dim);
+    Sampler *sampler = sampler_create(arena, data->num_items, rng_thread());
+    float learning_rate = 0.0003;
+    float epoch_loss = 0;
+
+    printf("Training for one epoch of %u iterations\n", data->num_items);
+
+    for (size_t i = 0; i < data->num_items; i++) {
+        size_t index = sampler_next(sampler);
+
+        get_example(data, index, pixels);
+
+        for (size_t j = 0; j < input_dim; j++) {
+            inputs[j]->data = pixels[j];
+        }
+
+        y->data = (float) data->labels[index];
+
+        graph_optimisation_step(graph, learning_rate);
+
+        epoch_loss += graph->values[0]->data;
+    }
+
+    printf("Loss: %f\n", epoch_loss / data->num_items);
+
+    // Serving only needs the prediction, so drop the loss node from the served graph
+    Graph *inference_graph = graph_create(arena, outputs[0], 400000);
+
+    ServerConfig server_config = {
+        .socket_path = SOCKET_PATH,
+        .max_batch_size = MAX_BATCH_SIZE,
+        .max_wait_us = MAX_WAIT_US,
+        .max_connections = MAX_CONNECTIONS,
+        .num_workers = SERVER_WORKERS
+    };
+
+    Server *server = server_create(arena, inference_graph, inputs, input_dim, outputs, 1, server_config);
+
+    server_run(server);
+    server_report(server);
+    server_destroy(server);
+
+    arena_destroy(arena);
+    return 0;
+}
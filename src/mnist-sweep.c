@@ -0,0 +1,89 @@
+/*
+
+Sweep learning rates and network shapes for the MNIST 0 vs 1 task. The data is loaded once and shared
+by every trial; trials run concurrently and the ones falling behind the median are stopped early.
+Trials are compared on examples held out from the training set, so the test set stays unseen
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "mnist.h"
+#include "sweep.h"
+
+#define RESULTS_PATH    "./sweep-results.tsv"
+#define NUM_WORKERS     4
+#define NUM_VALIDATION  1000    // Zeros and ones held out from the training set
+
+int main(void) {
+    Arena *arena = arena_create(100000000);
+
+    printf("Loading data\n");
+
+    MNISTData *train_data = load_dataset(arena, NUM_TRAIN_EXAMPLES, TRAIN_IMAGES_FILEPATH, TRAIN_LABELS_FILEPATH);
+    MNISTData *data = get_zeros_and_ones(arena, train_data);
+    MNISTData *validation_data = split_dataset(arena, data, NUM_VALIDATION);
+
+    float learning_rates[] = { 0.0001f, 0.0003f, 0.001f, 0.003f, 0.01f };
+    size_t num_rates = sizeof(learning_rates) / sizeof(learning_rates[0]);
+
+    NetworkConfig networks[] = {
+        {
+            .num_layers = 1,
+            .num_neurons = (size_t[]) { 1 },
+            .output_activation = ACT_SIGMOID,
+            .initializer = INIT_XAVIER,
+            .sparse_inputs = true
+        },
+        {
+            .num_layers = 2,
+            .num_neurons = (size_t[]) { 8, 1 },
+            .hidden_activation = ACT_RELU,
+            .output_activation = ACT_SIGMOID,
+            .initializer = INIT_HE,
+            .sparse_inputs = true
+        }
+    };
+    size_t num_networks = sizeof(networks) / sizeof(networks[0]);
+
+    size_t num_trials = num_rates * num_networks;
+    SweepTrialConfig *trials = (SweepTrialConfig *) arena_allocate(arena, sizeof(SweepTrialConfig) * num_trials);
+
+    for (size_t n = 0; n < num_networks; n++) {
+        for (size_t r = 0; r < num_rates; r++) {
+            trials[n * num_rates + r] = (SweepTrialConfig) {
+                .learning_rate = learning_rates[r],
+                .network = networks[n]
+            };
+        }
+    }
+
+    SweepConfig config = {
+        .max_steps = 4000,
+        .eval_interval = 500,
+        .num_validation = 0,
+        .min_checkpoints = 2,
+        .arena_size = 50000000,
+        .max_values = 400000,
+        .num_workers = NUM_WORKERS,
+        .seed = 42
+    };
+
+    printf("Running %zu trials on %d workers\n", num_trials, NUM_WORKERS);
+
+    Sweep *sweep = sweep_create(arena, data, validation_data, trials, num_trials, config);
+
+    sweep_run(sweep);
+    sweep_print(sweep);
+
+    if (sweep_write(sweep, RESULTS_PATH)) printf("Results written to %s\n", RESULTS_PATH);
+
+    sweep_destroy(sweep);
+
+    arena_destroy(arena);
+    return 0;
+}
@@ -6,6 +6,7 @@ Load MNIST data and display random examples
 
 #include <time.h>
 #include "mnist.h"
+#include "random.h"
 #include "raylib.h"
 
 #define WINDOW_W    448
@@ -22,7 +23,7 @@ typedef struct {
 } DisplayData;
 
 int main(void) {
-    srand(time(NULL));
+    rng_set_seed((uint64_t) time(NULL));
 
     InitWindow(WINDOW_W, WINDOW_H, "MNIST Data");
     SetTargetFPS(TARGET_FPS);
@@ -39,7 +40,7 @@ int main(void) {
     {
         if (IsKeyPressed(KEY_SPACE) || first_frame) {
             first_frame = false;
-            display_data.index = (size_t) (data->num_items * (float) rand() / (float) RAND_MAX);
+            display_data.index = rng_below(rng_thread(), data->num_items);
             display_data.start_index = display_data.index * data->num_rows * data->num_cols;
             display_data.label = data->labels[display_data.index];
             sprintf(display_data.text_label, "Label: %hhu", display_data.label);
@@ -1,15 +1,23 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include "arena.h"
+#include "eval.h"
 #include "micrograd.h"
 #include "mnist.h"
 #include "raylib.h"
+#include "telemetry.h"
 
-#define WINDOW_W    896
-#define WINDOW_H    448
-#define TARGET_FPS  60
-#define PIXEL_SIZE  16
+#define WINDOW_W        896
+#define WINDOW_H        448
+#define TARGET_FPS      60
+#define PIXEL_SIZE      16
+#define EVAL_THREADS    4
+#define METRICS_ENV     "MNIST_METRICS"
+#define METRICS_MS      1000
 
 uint8_t inference_image[IMAGE_HEIGHT][IMAGE_WIDTH] = { };
 
@@ -22,7 +30,7 @@ void initialise_image() {
 }
 
 int main(void) {
-    srand(time(NULL));
+    rng_set_seed((uint64_t) time(NULL));
 
     Arena *arena = arena_create(100000000);
     size_t input_dim = IMAGE_HEIGHT * IMAGE_WIDTH;
@@ -31,6 +39,8 @@ int main(void) {
 
     MNISTData *train_data = load_dataset(arena, NUM_TRAIN_EXAMPLES, TRAIN_IMAGES_FILEPATH, TRAIN_LABELS_FILEPATH);
     MNISTData *data = get_zeros_and_ones(arena, train_data);
+    MNISTData *test_data = load_dataset(arena, NUM_TEST_EXAMPLES, TEST_IMAGES_FILEPATH, TEST_LABELS_FILEPATH);
+    MNISTData *eval_data = get_zeros_and_ones(arena, test_data);
 
     printf("Creating model\n");
 
@@ -41,7 +51,9 @@ int main(void) {
         .num_inputs = input_dim,
         .num_layers = 1,
         .num_neurons = (size_t[]) { 1 },
-        .output_activation = ACT_SIGMOID
+        .output_activation = ACT_SIGMOID,
+        .initializer = INIT_XAVIER,
+        .sparse_inputs = true   // Most pixels are exactly zero
     };
 
     Value **outputs = network_create(arena, inputs, config);
@@ -52,17 +64,50 @@ int main(void) {
 
     Graph *graph = graph_create(arena, loss, 400000);
 
+    // Copy the finished graph in execution order; the handles we keep are remapped to the copies
+    Value **handles = (Value **) arena_allocate(arena, sizeof(Value *) * (input_dim + 2));
+
+    memcpy(handles, inputs, sizeof(Value *) * input_dim);
+    handles[input_dim] = y;
+    handles[input_dim + 1] = y_pred;
+
+    graph = graph_relayout(arena, graph, handles, input_dim + 2);
+    inputs = handles;
+    y = handles[input_dim];
+    y_pred = outputs[0] = handles[input_dim + 1];
+
     printf("Final value count = %zu\n", graph->num_values);
 
+    // Test set evaluation runs in the background on a snapshot of the weights, so training never waits for it
+    Evaluator *evaluator = evaluator_create(arena, graph, inputs, input_dim, y, outputs, 1, EVAL_THREADS);
+    EvalResult eval_result;
+
+    Sampler *sampler = sampler_create(arena, data->num_items, rng_thread());
     size_t num_iterations = 2 * data->num_items;
     float learning_rate = 0.0003;
     float epoch_loss = 0;
 
+    // Opt-in: with METRICS_ENV set to a path, throughput, step times and arena usage are written there
+    // every METRICS_MS
+    const char *metrics_path = getenv(METRICS_ENV);
+    Telemetry *telemetry = NULL;
+
+    if (metrics_path) {
+        telemetry = telemetry_create((TelemetryConfig) {
+            .path = metrics_path,
+            .format = TELEMETRY_PROMETHEUS,
+            .interval_ms = METRICS_MS
+        });
+
+        telemetry_watch_arena(telemetry, "main", arena);
+    }
+
     printf("Starting training.. each epoch will have %u iterations\n", data->num_items);
 
     for (size_t i = 0; i < num_iterations; i++) {
         // Load example
-        size_t index = (size_t) (data->num_items * (float) rand() / (float) RAND_MAX);
+        uint64_t data_start = time_now_ns();
+        size_t index = sampler_next(sampler);
         size_t start_index = index * data->num_rows * data->num_cols;
 
         for (size_t row = 0; row < data->num_rows; row++) {
@@ -76,16 +121,28 @@ int main(void) {
 
         y->data = (float) data->labels[index];
 
+        uint64_t step_start = time_now_ns();
+
         graph_optimisation_step(graph, learning_rate);
 
+        if (telemetry) telemetry_step(telemetry, 1, graph->values[0]->data, step_start - data_start, time_now_ns() - step_start);
         epoch_loss += graph->values[0]->data;
 
         if ((i + 1) % data->num_items == 0) {
             printf("Epoch: %4zu, Loss: %f\n", (i + 1) / data->num_items, epoch_loss / data->num_items);
             epoch_loss = 0;
+
+            if (!evaluator_start(evaluator, eval_data)) printf("Skipping evaluation, the previous one is still running\n");
         }
+
+        if (evaluator_poll(evaluator, &eval_result)) eval_result_print(&eval_result, evaluator->num_classes);
     }
 
+    // The last epoch's evaluation may still be in flight
+    if (evaluator_wait(evaluator, &eval_result)) eval_result_print(&eval_result, evaluator->num_classes);
+
+    if (telemetry) telemetry_destroy(telemetry);
+
     // Inference starts here
     InitWindow(WINDOW_W, WINDOW_H, "MNIST Inference");
     SetTargetFPS(TARGET_FPS);
@@ -156,6 +213,7 @@ int main(void) {
     }
 
     CloseWindow();
+    evaluator_destroy(evaluator);
     arena_destroy(arena);
     return 0;
 }
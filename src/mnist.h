@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 
 #include "arena.h"
@@ -69,7 +70,7 @@ void read_images_file(const char *filepath, MNISTData *data) {
             for (uint32_t col = 0; col < num_cols_i; col++) {
                 unsigned char pixel = 0;
                 fread((char *) &pixel, sizeof(pixel), 1, file);
-                data->images[i * num_cols_i * num_rows_i + row * num_cols_i + col] = (u_int8_t) pixel;
+                data->images[i * num_cols_i * num_rows_i + row * num_cols_i + col] = (uint8_t) pixel;
             }
         }
     }
@@ -97,7 +98,7 @@ void read_labels_file(const char *filepath, MNISTData *data) {
     for (size_t i = 0; i < num_items_i; i++) {
         unsigned char label = 0;
         fread((char *) &label, sizeof(label), 1, file);
-        data->labels[i] = (u_int8_t) label;
+        data->labels[i] = (uint8_t) label;
     }
 
     fclose(file);
@@ -159,4 +160,32 @@ MNISTData *get_zeros_and_ones(Arena *arena, MNISTData *data) {
     return data_slice;
 }
 
+MNISTData *split_dataset(Arena *arena, MNISTData *data, uint32_t num_holdout) {
+    // Move the last `num_holdout` examples into a new MNISTData, e.g. to validate on examples the model
+    // never trains on without touching the test set. Both share the original buffers.
+    assert(num_holdout < data->num_items);
+
+    MNISTData *holdout = (MNISTData *) arena_allocate(arena, sizeof(MNISTData));
+    uint32_t num_kept = data->num_items - num_holdout;
+
+    *holdout = *data;
+    holdout->images = data->images + (size_t) num_kept * data->num_rows * data->num_cols;
+    holdout->labels = data->labels + num_kept;
+    holdout->num_items = num_holdout;
+
+    data->num_items = num_kept;
+
+    return holdout;
+}
+
+void get_example(MNISTData *data, size_t index, float *pixels) {
+    // Copy one image into `pixels` scaled to [0, 1]
+    size_t num_pixels = data->num_rows * data->num_cols;
+    size_t start_index = index * num_pixels;
+
+    for (size_t i = 0; i < num_pixels; i++) {
+        pixels[i] = (float) data->images[start_index + i] / (float) 255;
+    }
+}
+
 #endif
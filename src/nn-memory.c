@@ -0,0 +1,136 @@
+/*
+
+Train a deep network through a static memory plan, which shares storage between intermediate
+activations and gradients whose live ranges do not overlap, and compare against graph_optimisation_step.
+The plan is relocated out of the graph's arena, so only the plan stays resident
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "plan.h"
+#include "timing.h"
+
+#define NUM_INPUTS      784
+#define NUM_HIDDEN      32
+#define NUM_STEPS       20
+
+void randomise_inputs(Value **inputs, Value *y) {
+    for (size_t i = 0; i < NUM_INPUTS; i++) {
+        inputs[i]->data = float_create_random();
+    }
+
+    y->data = float_create_random();
+}
+
+int main(void) {
+    rng_set_seed((uint64_t) time(NULL));
+
+    // The graph is built in its own arena so it can be dropped once the plan no longer reads it
+    Arena *graph_arena = arena_create(200000000);
+    Arena *arena = arena_create(200000000);
+
+    Value **inputs = inputs_create(graph_arena, NUM_INPUTS);
+    Value *y = value_create_constant(graph_arena, 0);
+
+    NetworkConfig config = {
+        .num_inputs = NUM_INPUTS,
+        .num_layers = 5,
+        .num_neurons = (size_t[]) { NUM_HIDDEN, NUM_HIDDEN, NUM_HIDDEN, NUM_HIDDEN, 1 },
+        .hidden_activation = ACT_RELU,
+        .output_activation = ACT_LINEAR,
+        .initializer = INIT_HE
+    };
+
+    Value **outputs = network_create(graph_arena, inputs, config);
+    Value *loss = loss_mean_squared_error(graph_arena, y, outputs[0]);
+    Graph *graph = graph_create(graph_arena, loss, 1000000);
+    size_t graph_bytes = graph_arena->position;
+
+    printf("Graph has %zu values\n", graph->num_values);
+
+    double start = time_now_seconds();
+
+    for (size_t i = 0; i < NUM_STEPS; i++) {
+        randomise_inputs(inputs, y);
+        graph_optimisation_step(graph, 0.001);
+    }
+
+    double graph_time = (time_now_seconds() - start) / NUM_STEPS;
+
+    // Reference loss, output and parameter gradients from the unplanned executor
+    randomise_inputs(inputs, y);
+
+    graph_zero_grad(graph);
+    graph_forward(graph);
+    graph_backward(graph);
+
+    float graph_loss = graph->values[0]->data;
+    float graph_output = outputs[0]->data;
+    float *graph_grads = (float *) calloc(graph->num_values, sizeof(float));
+    size_t num_leaves = 0;
+
+    for (size_t i = 0; i < graph->num_values; i++) {
+        if (!graph->values[i]->forward) graph_grads[num_leaves++] = graph->values[i]->grad;
+    }
+
+    // Plan, then move the leaves and the output into the plan's arena and drop the graph. The handles
+    // the program keeps (inputs, label and output) are remapped to the moved values.
+    Value **handles = (Value **) calloc(NUM_INPUTS + 2, sizeof(Value *));
+
+    memcpy(handles, inputs, sizeof(Value *) * NUM_INPUTS);
+    handles[NUM_INPUTS] = y;
+    handles[NUM_INPUTS + 1] = outputs[0];
+
+    MemoryPlan *plan = plan_create(arena, graph, outputs, 1);
+
+    plan_relocate(arena, plan, handles, NUM_INPUTS + 2);
+    arena_destroy(graph_arena);
+    graph_arena = NULL;
+    graph = NULL;
+
+    inputs = handles;
+    y = handles[NUM_INPUTS];
+    outputs = handles + NUM_INPUTS + 1;
+
+    plan_print(plan);
+
+    // The planned and the unplanned executors must agree on the loss, the output and every parameter gradient
+    plan_zero_grad(plan);
+    plan_forward(plan);
+    plan_backward(plan);
+
+    float max_grad_diff = 0;
+
+    for (size_t i = 0; i < plan->num_leaves; i++) {
+        if (!plan->leaves[i]->not_trainable) max_grad_diff = fmaxf(max_grad_diff, fabsf(graph_grads[i] - plan->leaves[i]->grad));
+    }
+
+    printf("Loss graph: %f, planned: %f\n", graph_loss, plan->pinned[0]->data);
+    printf("Output graph: %f, planned: %f, max parameter gradient difference: %g\n", graph_output, outputs[0]->data, max_grad_diff);
+
+    start = time_now_seconds();
+
+    for (size_t i = 0; i < NUM_STEPS; i++) {
+        randomise_inputs(inputs, y);
+        plan_optimisation_step(plan, 0.001);
+    }
+
+    double plan_time = (time_now_seconds() - start) / NUM_STEPS;
+
+    printf("Resident bytes graph: %zu, planned: %zu (%.1fx smaller)\n", graph_bytes, plan->num_bytes, (double) graph_bytes / (double) plan->num_bytes);
+    printf("Step time graph: %.3f ms, planned: %.3f ms\n", graph_time * 1e3, plan_time * 1e3);
+
+    free(handles);
+    handles = NULL;
+    free(graph_grads);
+    graph_grads = NULL;
+
+    arena_destroy(arena);
+    return 0;
+}
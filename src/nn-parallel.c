@@ -0,0 +1,111 @@
+/*
+
+Train a wide network with level-scheduled parallel forward and backward passes and compare against
+the serial graph_optimisation_step
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "pool.h"
+#include "schedule.h"
+#include "timing.h"
+
+#define NUM_INPUTS      784
+#define NUM_HIDDEN      64
+#define NUM_STEPS       20
+
+void randomise_inputs(Value **inputs, Value *y) {
+    for (size_t i = 0; i < NUM_INPUTS; i++) {
+        inputs[i]->data = float_create_random();
+    }
+
+    y->data = float_create_random();
+}
+
+int main(void) {
+    rng_set_seed((uint64_t) time(NULL));
+
+    Arena *arena = arena_create(200000000);
+
+    Value **inputs = inputs_create(arena, NUM_INPUTS);
+    Value *y = value_create_constant(arena, 0);
+
+    NetworkConfig config = {
+        .num_inputs = NUM_INPUTS,
+        .num_layers = 2,
+        .num_neurons = (size_t[]) { NUM_HIDDEN, 1 },
+        .hidden_activation = ACT_RELU,
+        .output_activation = ACT_LINEAR
+    };
+
+    Value **outputs = network_create(arena, inputs, config);
+    Value *loss = loss_mean_squared_error(arena, y, outputs[0]);
+    Graph *graph = graph_create(arena, loss, 1000000);
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    ThreadPool *pool = pool_create(num_cpus > 0 ? (size_t) num_cpus : 1);
+    Schedule *schedule = schedule_create(arena, graph);
+
+    printf("Graph has %zu values, pool has %zu workers\n", graph->num_values, pool->num_workers);
+    schedule_print(schedule);
+
+    // Both executors must agree on the loss and on every gradient
+    randomise_inputs(inputs, y);
+
+    graph_zero_grad(graph);
+    graph_forward(graph);
+    graph_backward(graph);
+
+    float serial_loss = graph->values[0]->data;
+    float *serial_grads = (float *) calloc(graph->num_values, sizeof(float));
+
+    for (size_t i = 0; i < graph->num_values; i++) {
+        serial_grads[i] = graph->values[i]->grad;
+    }
+
+    graph_zero_grad(graph);
+    schedule_forward(schedule, pool);
+    schedule_backward(graph, schedule, pool);
+
+    float max_grad_diff = 0;
+
+    for (size_t i = 0; i < graph->num_values; i++) {
+        max_grad_diff = fmaxf(max_grad_diff, fabsf(serial_grads[i] - graph->values[i]->grad));
+    }
+
+    printf("Loss serial: %f, scheduled: %f, max gradient difference: %g\n", serial_loss, graph->values[0]->data, max_grad_diff);
+
+    double start = time_now_seconds();
+
+    for (size_t i = 0; i < NUM_STEPS; i++) {
+        randomise_inputs(inputs, y);
+        graph_optimisation_step(graph, 0.001);
+    }
+
+    double serial_time = (time_now_seconds() - start) / NUM_STEPS;
+
+    start = time_now_seconds();
+
+    for (size_t i = 0; i < NUM_STEPS; i++) {
+        randomise_inputs(inputs, y);
+        schedule_optimisation_step(graph, schedule, pool, 0.001);
+    }
+
+    double scheduled_time = (time_now_seconds() - start) / NUM_STEPS;
+
+    printf("Step time serial: %.3f ms, scheduled: %.3f ms (%.2fx)\n", serial_time * 1e3, scheduled_time * 1e3, serial_time / scheduled_time);
+
+    free(serial_grads);
+    serial_grads = NULL;
+
+    pool_destroy(pool);
+    arena_destroy(arena);
+    return 0;
+}
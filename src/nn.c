@@ -1,8 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include "arena.h"
 #include "micrograd.h"
+#include "telemetry.h"
 
 float compute_y(float x1, float x2, float x3) {
     float noise = float_create_random() / (float) 10;
@@ -15,9 +19,9 @@ float compute_y(float x1, float x2, float x3) {
 }
 
 int main(void) {
-    srand(time(NULL));
+    rng_set_seed((uint64_t) time(NULL));
 
-    Arena *arena = arena_create(8192);
+    Arena *arena = arena_create(16384);
 
     Value **inputs = inputs_create(arena, 3);
     Value *y = value_create_constant(arena, 0);
@@ -40,20 +44,40 @@ int main(void) {
     size_t log_interval = 200;
     float learning_rate = 0.3;
 
+    // Telemetry is opt-in: NN_METRICS=<path> appends JSON lines to <path> every 100 ms
+    const char *metrics_path = getenv("NN_METRICS");
+    Telemetry *telemetry = NULL;
+
+    if (metrics_path) {
+        telemetry = telemetry_create((TelemetryConfig) {
+            .path = metrics_path,
+            .format = TELEMETRY_JSON,
+            .interval_ms = 100
+        });
+    }
+
     for (size_t i = 0; i < num_iterations; i++) {
+        uint64_t data_start = time_now_ns();
+
         inputs[0]->data = float_create_random();
         inputs[1]->data = float_create_random();
         inputs[2]->data = float_create_random();
 
         y->data = compute_y(inputs[0]->data, inputs[1]->data, inputs[2]->data);
 
+        uint64_t step_start = time_now_ns();
+
         graph_optimisation_step(graph, learning_rate);
 
+        if (telemetry) telemetry_step(telemetry, 1, graph->values[0]->data, step_start - data_start, time_now_ns() - step_start);
+
         if ((i + 1) % log_interval == 0) {
             printf("Iter: %5zu, Loss: %f\n", i, graph->values[0]->data);
         }
     }
 
+    if (telemetry) telemetry_destroy(telemetry);
+
     arena_destroy(arena);
     return 0;
 }
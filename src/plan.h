@@ -0,0 +1,639 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.h"
+#include "conv.h"
+#include "micrograd.h"
+
+#define PLAN_NO_STATE   UINT32_MAX
+
+typedef enum {
+    PLAN_KERNEL_ADD,
+    PLAN_KERNEL_MUL,
+    PLAN_KERNEL_RELU,
+    PLAN_KERNEL_SIGMOID,
+    PLAN_KERNEL_GENERIC     // Any other op runs its own forward and backward on scratch values
+} PLAN_KERNEL;
+
+// One computed value. Its activation and gradient live at `data` and `grad`: a shared slot for
+// intermediates, or the value's own fields for pinned values. The built-in kernels have at most two
+// children and run straight on these pointers; generic steps keep their operands in plan->generic.
+typedef struct {
+    PLAN_KERNEL kernel;
+    uint32_t    generic;
+    float       *data;
+    float       *grad;
+    float       *child_data[2];
+    float       *child_grad[2];
+} PlanStep;
+
+// What a generic step needs to call an op's own kernels, copied out of the value
+typedef struct {
+    char        repr;
+    size_t      num_children;
+    void        *state;
+    size_t      state_size;
+    void        (*forward)  (Value *self);
+    void        (*backward) (Value *self);
+    float       **child_data;
+    float       **child_grad;
+    uint32_t    *child_state;   // The generic step that owns each child's state, or PLAN_NO_STATE
+} PlanGeneric;
+
+// A static memory plan for a graph. Every intermediate activation and gradient is live from the step
+// that produces it to the last step that reads it; values whose live ranges do not overlap share a
+// slot. Leaves (parameters, inputs and constants) and pinned values keep their own storage, so
+// parameters, their gradients and the outputs the caller reads are found where they always were.
+// The steps hold everything needed to run the graph, so once plan_relocate has moved the leaves and
+// pinned values, the graph's own values are no longer needed.
+typedef struct {
+    PlanStep    *steps;             // Forward order: the graph's computed values from last to first
+    size_t      num_steps;
+    uint32_t    *backward_steps;    // Backward order; only values with a backward function
+    size_t      num_backward;
+    PlanGeneric *generic;
+    size_t      num_generic;
+
+    uint32_t    *zero_slots;        // Gradient slots to clear before backward step s:
+    size_t      *zero_offsets;      // zero_slots[zero_offsets[s]..zero_offsets[s + 1])
+
+    float       *slots;             // Two spare slots follow: gradients nobody writes, then those of constants
+    size_t      num_slots;
+
+    Value       **leaves;
+    size_t      num_leaves;
+    Value       **pinned;           // The root is always pinned
+    size_t      num_pinned;
+    bool        relocated;          // Leaves, pinned values and kernel state live in the plan's arena
+    size_t      num_bytes;          // Everything the plan allocated from its arena
+
+    Value       scratch;            // Generic kernels run on these, loaded from and stored back to the slots
+    Value       *scratch_children;
+    Value       **scratch_pointers;
+} MemoryPlan;
+
+// Header
+
+MemoryPlan *plan_create(Arena *arena, Graph *graph, Value **pinned, size_t num_pinned);
+void plan_relocate(Arena *arena, MemoryPlan *plan, Value **handles, size_t num_handles);
+void plan_forward(MemoryPlan *plan);
+void plan_backward(MemoryPlan *plan);
+void plan_zero_grad(MemoryPlan *plan);
+void plan_update(MemoryPlan *plan, float learning_rate);
+void plan_optimisation_step(MemoryPlan *plan, float learning_rate);
+void plan_print(MemoryPlan *plan);
+
+bool _plan_backward_reads_self(Value *value);
+bool _plan_backward_reads_children(Value *value);
+PLAN_KERNEL _plan_kernel(Value *value);
+void _plan_bucket(size_t *offsets, size_t num_buckets);
+float *_plan_move(MemoryPlan *plan, ValueMap *index, Value *moved, float *pointer, bool grad);
+void _plan_load_generic(MemoryPlan *plan, PlanStep *step);
+
+// Implementation
+
+bool _plan_backward_reads_self(Value *value) {
+    // Unknown kernels are assumed to read everything
+    if (value->backward == op_add_backward || value->backward == op_mul_backward) return false;
+    if (value->backward == op_sigmoid_backward || value->backward == op_clip_backward) return false;
+    if (value->backward == op_dot_sparse_backward) return false;
+    if (value->backward == op_tensor_backward || value->backward == op_tap_backward) return false;
+
+    return true;
+}
+
+bool _plan_backward_reads_children(Value *value) {
+    if (value->backward == op_add_backward || value->backward == op_relu_backward) return false;
+    if (value->backward == op_clip_backward) return false;
+    if (value->backward == op_tensor_backward || value->backward == op_tap_backward) return false;
+
+    return true;
+}
+
+PLAN_KERNEL _plan_kernel(Value *value) {
+    if (value->forward == op_add_forward && value->backward == op_add_backward && value->num_children == 2) return PLAN_KERNEL_ADD;
+    if (value->forward == op_mul_forward && value->backward == op_mul_backward && value->num_children == 2) return PLAN_KERNEL_MUL;
+    if (value->forward == op_relu_forward && value->backward == op_relu_backward && value->num_children == 1) return PLAN_KERNEL_RELU;
+    if (value->forward == op_sigmoid_forward && value->backward == op_sigmoid_backward && value->num_children == 1) return PLAN_KERNEL_SIGMOID;
+
+    return PLAN_KERNEL_GENERIC;
+}
+
+void _plan_bucket(size_t *offsets, size_t num_buckets) {
+    // Turns counts in offsets[1..num_buckets] into start offsets
+    offsets[0] = 0;
+
+    for (size_t b = 0; b < num_buckets; b++) {
+        offsets[b + 1] += offsets[b];
+    }
+}
+
+MemoryPlan *plan_create(Arena *arena, Graph *graph, Value **pinned, size_t num_pinned) {
+    assert(graph->values[0]->forward);
+
+    size_t num_values = graph->num_values;
+    ValueMap *index = graph_index_create(graph);
+    size_t arena_start = arena->position;
+    MemoryPlan *plan = (MemoryPlan *) arena_allocate(arena, sizeof(MemoryPlan));
+
+    *plan = (MemoryPlan) { };
+
+    // Time runs over the forward steps and then the backward steps; SIZE_MAX marks "not computed"
+    size_t *forward_time = (size_t *) calloc(num_values, sizeof(size_t));
+    size_t *backward_time = (size_t *) calloc(num_values, sizeof(size_t));
+    bool *is_pinned = (bool *) calloc(num_values, sizeof(bool));
+    size_t max_children = 0;
+
+    for (size_t i = num_values; i > 0; i--) {
+        Value *value = graph->values[i - 1];
+
+        forward_time[i - 1] = value->forward ? plan->num_steps++ : SIZE_MAX;
+        plan->num_leaves += value->forward ? 0 : 1;
+    }
+
+    for (size_t i = 0; i < num_values; i++) {
+        Value *value = graph->values[i];
+        backward_time[i] = value->forward && value->backward ? plan->num_steps + plan->num_backward++ : SIZE_MAX;
+    }
+
+    size_t num_times = plan->num_steps + plan->num_backward;
+
+    is_pinned[0] = true;
+
+    for (size_t i = 0; i < num_pinned; i++) {
+        size_t position = pinned[i] ? value_map_find(index, pinned[i]) : SIZE_MAX;
+        if (position != SIZE_MAX) is_pinned[position] = true;
+    }
+
+    // Live ranges [start, end] of every intermediate activation (2i) and gradient (2i + 1)
+    size_t *start = (size_t *) calloc(2 * num_values, sizeof(size_t));
+    size_t *end = (size_t *) calloc(2 * num_values, sizeof(size_t));
+
+    for (size_t i = 0; i < 2 * num_values; i++) {
+        start[i] = SIZE_MAX;
+        end[i] = 0;
+    }
+
+    for (size_t i = 0; i < num_values; i++) {
+        Value *value = graph->values[i];
+
+        if (!value->forward) continue;
+
+        if (!is_pinned[i]) {
+            start[2 * i] = forward_time[i];
+            end[2 * i] = end[2 * i] > forward_time[i] ? end[2 * i] : forward_time[i];
+        }
+
+        if (!is_pinned[i] && backward_time[i] != SIZE_MAX) {
+            end[2 * i + 1] = end[2 * i + 1] > backward_time[i] ? end[2 * i + 1] : backward_time[i];
+
+            if (_plan_backward_reads_self(value)) {
+                end[2 * i] = end[2 * i] > backward_time[i] ? end[2 * i] : backward_time[i];
+            }
+        }
+
+        for (size_t j = 0; j < value->num_children; j++) {
+            size_t child = value_map_find(index, value->children[j]);
+
+            if (!graph->values[child]->forward || is_pinned[child]) continue;
+
+            size_t last_read = forward_time[i];
+
+            if (backward_time[i] != SIZE_MAX) {
+                last_read = _plan_backward_reads_children(value) ? backward_time[i] : last_read;
+
+                // The parent's backward is the first write of the child's gradient if it runs earliest
+                start[2 * child + 1] = backward_time[i] < start[2 * child + 1] ? backward_time[i] : start[2 * child + 1];
+            }
+
+            end[2 * child] = last_read > end[2 * child] ? last_read : end[2 * child];
+        }
+    }
+
+    // Linear scan: walk time forwards, release the ranges that ended at the previous step, then give
+    // each range that starts now the most recently released slot
+    size_t *start_offsets = (size_t *) calloc(num_times + 2, sizeof(size_t));
+    size_t *end_offsets = (size_t *) calloc(num_times + 2, sizeof(size_t));
+    size_t *by_start = (size_t *) calloc(2 * num_values, sizeof(size_t));
+    size_t *by_end = (size_t *) calloc(2 * num_values, sizeof(size_t));
+    size_t *slot_of = (size_t *) calloc(2 * num_values, sizeof(size_t));
+    size_t *free_slots = (size_t *) calloc(2 * num_values, sizeof(size_t));
+    size_t num_free = 0;
+    size_t num_ranges = 0;
+
+    for (size_t r = 0; r < 2 * num_values; r++) {
+        if (start[r] == SIZE_MAX) continue;
+
+        end[r] = end[r] > start[r] ? end[r] : start[r];
+        start_offsets[start[r] + 1] += 1;
+        end_offsets[end[r] + 1] += 1;
+        num_ranges += 1;
+    }
+
+    _plan_bucket(start_offsets, num_times + 1);
+    _plan_bucket(end_offsets, num_times + 1);
+
+    for (size_t r = 0; r < 2 * num_values; r++) {
+        if (start[r] == SIZE_MAX) continue;
+
+        by_start[start_offsets[start[r]]++] = r;
+        by_end[end_offsets[end[r]]++] = r;
+    }
+
+    size_t next_start = 0;
+    size_t next_end = 0;
+
+    for (size_t t = 0; t < num_times; t++) {
+        while (next_end < num_ranges && end[by_end[next_end]] < t) {
+            free_slots[num_free++] = slot_of[by_end[next_end++]];
+        }
+
+        while (next_start < num_ranges && start[by_start[next_start]] == t) {
+            size_t r = by_start[next_start++];
+            slot_of[r] = num_free > 0 ? free_slots[--num_free] : plan->num_slots++;
+        }
+    }
+
+    size_t sink = plan->num_slots + 1;
+
+    plan->slots = (float *) arena_allocate(arena, sizeof(float) * (plan->num_slots + 2));
+    memset(plan->slots, 0, sizeof(float) * (plan->num_slots + 2));
+
+    // Gradients are accumulated with +=, so each gradient slot is cleared when its range begins
+    plan->zero_offsets = (size_t *) arena_allocate(arena, sizeof(size_t) * (plan->num_backward + 2));
+    memset(plan->zero_offsets, 0, sizeof(size_t) * (plan->num_backward + 2));
+
+    for (size_t i = 0; i < num_values; i++) {
+        if (start[2 * i + 1] != SIZE_MAX) plan->zero_offsets[start[2 * i + 1] - plan->num_steps + 1] += 1;
+    }
+
+    _plan_bucket(plan->zero_offsets, plan->num_backward);
+
+    size_t *zero_cursor = (size_t *) calloc(plan->num_backward + 1, sizeof(size_t));
+
+    plan->zero_slots = (uint32_t *) arena_allocate(arena, sizeof(uint32_t) * (plan->zero_offsets[plan->num_backward] + 1));
+    memcpy(zero_cursor, plan->zero_offsets, sizeof(size_t) * (plan->num_backward + 1));
+
+    for (size_t i = 0; i < num_values; i++) {
+        if (start[2 * i + 1] != SIZE_MAX) plan->zero_slots[zero_cursor[start[2 * i + 1] - plan->num_steps]++] = (uint32_t) slot_of[2 * i + 1];
+    }
+
+    // Resolve where every value's activation and gradient live. Nothing reads the gradient of a
+    // constant, so kernels add it to the sink instead of checking.
+    float **data_at = (float **) calloc(num_values, sizeof(float *));
+    float **grad_at = (float **) calloc(num_values, sizeof(float *));
+    size_t *generic_of = (size_t *) calloc(num_values, sizeof(size_t));
+    size_t num_pinned_values = 0;
+
+    for (size_t i = 0; i < num_values; i++) {
+        num_pinned_values += graph->values[i]->forward && is_pinned[i] ? 1 : 0;
+    }
+
+    plan->leaves = (Value **) arena_allocate(arena, sizeof(Value *) * (plan->num_leaves + 1));
+    plan->pinned = (Value **) arena_allocate(arena, sizeof(Value *) * (num_pinned_values + 1));
+    plan->num_leaves = 0;
+
+    for (size_t i = 0; i < num_values; i++) {
+        Value *value = graph->values[i];
+        bool own_storage = !value->forward || is_pinned[i];
+
+        data_at[i] = own_storage ? &value->data : &plan->slots[slot_of[2 * i]];
+        grad_at[i] = own_storage ? &value->grad : &plan->slots[plan->num_slots];
+
+        if (!own_storage && start[2 * i + 1] != SIZE_MAX) grad_at[i] = &plan->slots[slot_of[2 * i + 1]];
+        if (value_is_constant(value)) grad_at[i] = &plan->slots[sink];
+        if (!value->forward) plan->leaves[plan->num_leaves++] = value;
+        else if (is_pinned[i]) plan->pinned[plan->num_pinned++] = value;
+
+        generic_of[i] = value->forward && _plan_kernel(value) == PLAN_KERNEL_GENERIC ? plan->num_generic++ : SIZE_MAX;
+    }
+
+    plan->steps = (PlanStep *) arena_allocate(arena, sizeof(PlanStep) * (plan->num_steps + 1));
+    plan->backward_steps = (uint32_t *) arena_allocate(arena, sizeof(uint32_t) * (plan->num_backward + 1));
+    plan->generic = (PlanGeneric *) arena_allocate(arena, sizeof(PlanGeneric) * (plan->num_generic + 1));
+
+    for (size_t i = 0; i < num_values; i++) {
+        Value *value = graph->values[i];
+
+        if (!value->forward) continue;
+
+        PlanStep *step = &plan->steps[forward_time[i]];
+
+        *step = (PlanStep) {
+            .kernel = _plan_kernel(value),
+            .data = data_at[i],
+            .grad = grad_at[i]
+        };
+
+        if (backward_time[i] != SIZE_MAX) plan->backward_steps[backward_time[i] - plan->num_steps] = (uint32_t) forward_time[i];
+
+        if (step->kernel != PLAN_KERNEL_GENERIC) {
+            for (size_t j = 0; j < value->num_children; j++) {
+                size_t child = value_map_find(index, value->children[j]);
+
+                step->child_data[j] = data_at[child];
+                step->child_grad[j] = grad_at[child];
+            }
+
+            continue;
+        }
+
+        PlanGeneric *generic = &plan->generic[generic_of[i]];
+
+        step->generic = (uint32_t) generic_of[i];
+
+        *generic = (PlanGeneric) {
+            .repr = value->repr,
+            .num_children = value->num_children,
+            .state = value->state,
+            .state_size = value->state_size,
+            .forward = value->forward,
+            .backward = value->backward
+        };
+
+        generic->child_data = (float **) arena_allocate(arena, sizeof(float *) * (value->num_children + 1));
+        generic->child_grad = (float **) arena_allocate(arena, sizeof(float *) * (value->num_children + 1));
+        generic->child_state = (uint32_t *) arena_allocate(arena, sizeof(uint32_t) * (value->num_children + 1));
+
+        for (size_t j = 0; j < value->num_children; j++) {
+            size_t child = value_map_find(index, value->children[j]);
+
+            // Only generic steps have state: the scalar kernels and the leaves have none
+            generic->child_data[j] = data_at[child];
+            generic->child_grad[j] = grad_at[child];
+            generic->child_state[j] = value->children[j]->state ? (uint32_t) generic_of[child] : PLAN_NO_STATE;
+        }
+
+        max_children = value->num_children > max_children ? value->num_children : max_children;
+    }
+
+    plan->scratch_children = (Value *) arena_allocate(arena, sizeof(Value) * (max_children + 1));
+    plan->scratch_pointers = (Value **) arena_allocate(arena, sizeof(Value *) * (max_children + 1));
+
+    for (size_t j = 0; j < max_children; j++) {
+        plan->scratch_children[j] = (Value) { .repr = 'v' };
+        plan->scratch_pointers[j] = &plan->scratch_children[j];
+    }
+
+    plan->scratch = (Value) {
+        .children = plan->scratch_pointers
+    };
+
+    plan->num_bytes = arena->position - arena_start;
+
+    free(generic_of);
+    generic_of = NULL;
+    free(grad_at);
+    grad_at = NULL;
+    free(data_at);
+    data_at = NULL;
+    free(zero_cursor);
+    zero_cursor = NULL;
+    free(free_slots);
+    free_slots = NULL;
+    free(slot_of);
+    slot_of = NULL;
+    free(by_end);
+    by_end = NULL;
+    free(by_start);
+    by_start = NULL;
+    free(end_offsets);
+    end_offsets = NULL;
+    free(start_offsets);
+    start_offsets = NULL;
+    free(end);
+    end = NULL;
+    free(start);
+    start = NULL;
+    free(is_pinned);
+    is_pinned = NULL;
+    free(backward_time);
+    backward_time = NULL;
+    free(forward_time);
+    forward_time = NULL;
+    value_map_destroy(index);
+    index = NULL;
+
+    return plan;
+}
+
+float *_plan_move(MemoryPlan *plan, ValueMap *index, Value *moved, float *pointer, bool grad) {
+    // Slots stay where they are; any other operand is the data or grad field of a leaf or pinned value
+    if (!pointer || (pointer >= plan->slots && pointer <= plan->slots + plan->num_slots + 1)) return pointer;
+
+    Value *value = (Value *) ((char *) pointer - (grad ? offsetof(Value, grad) : offsetof(Value, data)));
+    size_t position = value_map_find(index, value);
+
+    assert(position != SIZE_MAX);
+
+    return grad ? &moved[position].grad : &moved[position].data;
+}
+
+void plan_relocate(Arena *arena, MemoryPlan *plan, Value **handles, size_t num_handles) {
+    // Copies the leaves, the pinned values and kernel state into arena and remaps the caller's handles in
+    // place, like graph_relayout. Afterwards the plan reads nothing from the graph, so the arena the
+    // graph was built in can be destroyed. Pinned copies keep their data and grad but lose their children.
+    assert(!plan->relocated);
+
+    size_t arena_start = arena->position;
+    size_t num_moved = plan->num_leaves + plan->num_pinned;
+    ValueMap *index = value_map_create(num_moved);
+    Value *moved = (Value *) arena_allocate(arena, sizeof(Value) * (num_moved + 1));
+
+    for (size_t i = 0; i < num_moved; i++) {
+        Value *value = i < plan->num_leaves ? plan->leaves[i] : plan->pinned[i - plan->num_leaves];
+
+        value_map_insert(index, value, i);
+        moved[i] = *value;
+        moved[i].num_children = 0;
+        moved[i].children = NULL;
+        moved[i].state = NULL;
+        moved[i].state_size = 0;
+    }
+
+    for (size_t s = 0; s < plan->num_steps; s++) {
+        PlanStep *step = &plan->steps[s];
+
+        step->data = _plan_move(plan, index, moved, step->data, false);
+        step->grad = _plan_move(plan, index, moved, step->grad, true);
+
+        for (size_t j = 0; j < 2; j++) {
+            step->child_data[j] = _plan_move(plan, index, moved, step->child_data[j], false);
+            step->child_grad[j] = _plan_move(plan, index, moved, step->child_grad[j], true);
+        }
+    }
+
+    for (size_t g = 0; g < plan->num_generic; g++) {
+        PlanGeneric *generic = &plan->generic[g];
+
+        for (size_t j = 0; j < generic->num_children; j++) {
+            generic->child_data[j] = _plan_move(plan, index, moved, generic->child_data[j], false);
+            generic->child_grad[j] = _plan_move(plan, index, moved, generic->child_grad[j], true);
+        }
+
+        if (generic->state) {
+            void *state = arena_allocate(arena, generic->state_size);
+
+            memcpy(state, generic->state, generic->state_size);
+            generic->state = state;
+        }
+    }
+
+    for (size_t i = 0; i < num_handles; i++) {
+        size_t position = handles[i] ? value_map_find(index, handles[i]) : SIZE_MAX;
+        if (position != SIZE_MAX) handles[i] = &moved[position];
+    }
+
+    for (size_t i = 0; i < num_moved; i++) {
+        if (i < plan->num_leaves) plan->leaves[i] = &moved[i];
+        else plan->pinned[i - plan->num_leaves] = &moved[i];
+    }
+
+    plan->relocated = true;
+    plan->num_bytes += arena->position - arena_start;
+
+    value_map_destroy(index);
+    index = NULL;
+}
+
+void _plan_load_generic(MemoryPlan *plan, PlanStep *step) {
+    PlanGeneric *generic = &plan->generic[step->generic];
+    Value *self = &plan->scratch;
+
+    self->repr = generic->repr;
+    self->state = generic->state;
+    self->data = *step->data;
+    self->num_children = generic->num_children;
+
+    for (size_t j = 0; j < generic->num_children; j++) {
+        uint32_t owner = generic->child_state[j];
+
+        plan->scratch_children[j].data = *generic->child_data[j];
+        plan->scratch_children[j].state = owner == PLAN_NO_STATE ? NULL : plan->generic[owner].state;
+    }
+}
+
+void plan_forward(MemoryPlan *plan) {
+    for (size_t s = 0; s < plan->num_steps; s++) {
+        PlanStep *step = &plan->steps[s];
+
+        switch (step->kernel) {
+            case PLAN_KERNEL_ADD:
+                *step->data = *step->child_data[0] + *step->child_data[1];
+                break;
+            case PLAN_KERNEL_MUL:
+                *step->data = *step->child_data[0] * *step->child_data[1];
+                break;
+            case PLAN_KERNEL_RELU:
+                *step->data = *step->child_data[0] > 0 ? *step->child_data[0] : 0;
+                break;
+            case PLAN_KERNEL_SIGMOID:
+                *step->data = float_sigmoid(*step->child_data[0]);
+                break;
+            case PLAN_KERNEL_GENERIC:
+                _plan_load_generic(plan, step);
+                plan->generic[step->generic].forward(&plan->scratch);
+                *step->data = plan->scratch.data;
+                break;
+        }
+    }
+}
+
+void plan_backward(MemoryPlan *plan) {
+    for (size_t i = 0; i < plan->num_pinned; i++) {
+        plan->pinned[i]->grad = 0;
+    }
+
+    plan->pinned[0]->grad = 1;
+
+    for (size_t s = 0; s < plan->num_backward; s++) {
+        PlanStep *step = &plan->steps[plan->backward_steps[s]];
+
+        for (size_t z = plan->zero_offsets[s]; z < plan->zero_offsets[s + 1]; z++) {
+            plan->slots[plan->zero_slots[z]] = 0;
+        }
+
+        float grad = *step->grad;
+
+        switch (step->kernel) {
+            case PLAN_KERNEL_ADD:
+                *step->child_grad[0] += grad;
+                *step->child_grad[1] += grad;
+                break;
+            case PLAN_KERNEL_MUL:
+                *step->child_grad[0] += *step->child_data[1] * grad;
+                *step->child_grad[1] += *step->child_data[0] * grad;
+                break;
+            case PLAN_KERNEL_RELU:
+                *step->child_grad[0] += *step->data > 0 ? grad : 0;
+                break;
+            case PLAN_KERNEL_SIGMOID: {
+                float sigmoid = float_sigmoid(*step->child_data[0]);
+
+                *step->child_grad[0] += grad * sigmoid * (1.0f - sigmoid);
+                break;
+            }
+            case PLAN_KERNEL_GENERIC: {
+                PlanGeneric *generic = &plan->generic[step->generic];
+
+                _plan_load_generic(plan, step);
+                plan->scratch.grad = grad;
+
+                // Children start from zero and are added back, so a value that appears twice gets both terms
+                for (size_t j = 0; j < generic->num_children; j++) {
+                    plan->scratch_children[j].grad = 0;
+                }
+
+                generic->backward(&plan->scratch);
+
+                for (size_t j = 0; j < generic->num_children; j++) {
+                    *generic->child_grad[j] += plan->scratch_children[j].grad;
+                }
+
+                break;
+            }
+        }
+    }
+}
+
+void plan_zero_grad(MemoryPlan *plan) {
+    // Intermediate gradients are cleared by plan_backward as their slots come into use
+    for (size_t i = 0; i < plan->num_leaves; i++) {
+        plan->leaves[i]->grad = 0;
+    }
+}
+
+void plan_update(MemoryPlan *plan, float learning_rate) {
+    for (size_t i = 0; i < plan->num_leaves; i++) {
+        Value *value = plan->leaves[i];
+
+        if (!value->not_trainable) {
+            value->data -= value->grad * learning_rate;
+        }
+    }
+}
+
+void plan_optimisation_step(MemoryPlan *plan, float learning_rate) {
+    plan_zero_grad(plan);
+    plan_forward(plan);
+    plan_backward(plan);
+    plan_update(plan, learning_rate);
+}
+
+void plan_print(MemoryPlan *plan) {
+    size_t unplanned = 2 * (plan->num_steps - plan->num_pinned);
+
+    printf("===== MemoryPlan(%zu steps) =====\n", plan->num_steps);
+    printf("Leaves: %zu, pinned: %zu, generic steps: %zu\n", plan->num_leaves, plan->num_pinned, plan->num_generic);
+    printf("Intermediate activations and gradients: %zu floats in %zu slots\n", unplanned, plan->num_slots);
+    printf("Resident: %zu bytes%s\n", plan->num_bytes, plan->relocated ? "" : ", plus the graph it reads from");
+    printf("===========================\n");
+}
+
+#endif // PLAN_H
@@ -0,0 +1,260 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "arena.h"
+
+#define POOL_QUEUE_CAPACITY 1024
+
+typedef void (*TaskFunction)(void *context, size_t begin, size_t end, size_t worker);
+
+typedef struct {
+    TaskFunction    function;
+    void            *context;
+    size_t          begin;
+    size_t          end;
+} Task;
+
+// Each worker owns a deque: it pops its own tasks from the bottom while idle workers steal from the top
+typedef struct {
+    pthread_mutex_t lock;
+    Task            tasks[POOL_QUEUE_CAPACITY];
+    size_t          top;
+    size_t          bottom;
+} TaskQueue;
+
+typedef struct ThreadPool ThreadPool;
+
+typedef struct {
+    ThreadPool  *pool;
+    size_t      worker;
+} WorkerArgs;
+
+// A persistent pool for fork-join loops. One thread at a time calls pool_parallel_for, and tasks must
+// not call it again themselves.
+struct ThreadPool {
+    size_t          num_workers;    // Worker 0 is the thread calling pool_parallel_for
+    pthread_t       *threads;
+    WorkerArgs      *args;
+    TaskQueue       *queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  work_cond;
+    pthread_cond_t  done_cond;
+    size_t          generation;
+    atomic_size_t   pending;
+    bool            stop;
+};
+
+// Header
+
+ThreadPool *pool_create(size_t num_workers);
+void pool_destroy(ThreadPool *pool);
+void pool_parallel_for(ThreadPool *pool, size_t begin, size_t end, size_t chunk, TaskFunction function, void *context);
+
+bool _pool_pop(TaskQueue *queue, Task *task);
+bool _pool_steal(TaskQueue *queue, Task *task);
+void _pool_drain(ThreadPool *pool, size_t worker);
+void *_pool_worker(void *arg);
+
+// Implementation
+
+ThreadPool *pool_create(size_t num_workers) {
+    assert(num_workers > 0);
+
+    ThreadPool *pool = (ThreadPool *) calloc(1, sizeof(ThreadPool));
+
+    pool->num_workers = num_workers;
+    pool->threads = (pthread_t *) calloc(num_workers, sizeof(pthread_t));
+    pool->args = (WorkerArgs *) calloc(num_workers, sizeof(WorkerArgs));
+    pool->queues = (TaskQueue *) calloc(num_workers, sizeof(TaskQueue));
+
+    atomic_init(&pool->pending, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (size_t i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    }
+
+    for (size_t i = 1; i < num_workers; i++) {
+        pool->args[i] = (WorkerArgs) {
+            .pool = pool,
+            .worker = i
+        };
+
+        pthread_create(&pool->threads[i], NULL, _pool_worker, &pool->args[i]);
+    }
+
+    return pool;
+}
+
+void pool_destroy(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 1; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < pool->num_workers; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->queues);
+    pool->queues = NULL;
+    free(pool->args);
+    pool->args = NULL;
+    free(pool->threads);
+    pool->threads = NULL;
+    free(pool);
+    pool = NULL;
+}
+
+void pool_parallel_for(ThreadPool *pool, size_t begin, size_t end, size_t chunk, TaskFunction function, void *context) {
+    if (begin >= end) return;
+    if (chunk == 0) chunk = 1;
+
+    size_t num_tasks = (end - begin + chunk - 1) / chunk;
+
+    // Not worth waking anyone up
+    if (num_tasks == 1 || pool->num_workers == 1) {
+        function(context, begin, end, 0);
+        return;
+    }
+
+    assert(num_tasks <= POOL_QUEUE_CAPACITY * pool->num_workers);
+
+    // Hand each worker a contiguous run of chunks, so stealing only kicks in on imbalance
+    atomic_store(&pool->pending, num_tasks);
+
+    for (size_t w = 0; w < pool->num_workers; w++) {
+        TaskQueue *queue = &pool->queues[w];
+        size_t first = num_tasks * w / pool->num_workers;
+        size_t last = num_tasks * (w + 1) / pool->num_workers;
+
+        pthread_mutex_lock(&queue->lock);
+
+        queue->top = 0;
+        queue->bottom = 0;
+
+        for (size_t t = first; t < last; t++) {
+            size_t task_begin = begin + t * chunk;
+            size_t task_end = task_begin + chunk < end ? task_begin + chunk : end;
+
+            queue->tasks[queue->bottom++] = (Task) {
+                .function = function,
+                .context = context,
+                .begin = task_begin,
+                .end = task_end
+            };
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->generation += 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    _pool_drain(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (atomic_load(&pool->pending) > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+bool _pool_pop(TaskQueue *queue, Task *task) {
+    pthread_mutex_lock(&queue->lock);
+
+    bool found = queue->bottom > queue->top;
+
+    if (found) {
+        queue->bottom -= 1;
+        *task = queue->tasks[queue->bottom];
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+bool _pool_steal(TaskQueue *queue, Task *task) {
+    pthread_mutex_lock(&queue->lock);
+
+    bool found = queue->bottom > queue->top;
+
+    if (found) {
+        *task = queue->tasks[queue->top];
+        queue->top += 1;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+void _pool_drain(ThreadPool *pool, size_t worker) {
+    Task task;
+
+    while (true) {
+        bool found = _pool_pop(&pool->queues[worker], &task);
+
+        for (size_t i = 1; !found && i < pool->num_workers; i++) {
+            found = _pool_steal(&pool->queues[(worker + i) % pool->num_workers], &task);
+        }
+
+        if (!found) return;
+
+        task.function(task.context, task.begin, task.end, worker);
+
+        if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_broadcast(&pool->done_cond);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+}
+
+void *_pool_worker(void *arg) {
+    WorkerArgs *args = (WorkerArgs *) arg;
+    ThreadPool *pool = args->pool;
+    size_t seen_generation = 0;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+
+        while (!pool->stop && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+
+        bool stop = pool->stop;
+        seen_generation = pool->generation;
+
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stop) break;
+
+        _pool_drain(pool, args->worker);
+    }
+
+    return NULL;
+}
+
+#endif // POOL_H
@@ -0,0 +1,478 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "arena.h"
+#include "kernels.h"
+#include "micrograd.h"
+#include "mnist.h"
+
+#define INT8_LEVELS         127
+#define QUANT_BATCH_SIZE    64      // Examples per quant_model_forward call in calibration and accuracy
+
+typedef enum {
+    PRECISION_FP32,
+    PRECISION_BF16,
+    PRECISION_FP16,
+    PRECISION_INT8
+} PRECISION;
+
+typedef enum {
+    QUANT_PER_TENSOR,   // One scale for every weight of a layer
+    QUANT_PER_CHANNEL   // One scale per neuron, i.e. per row of a layer's weights
+} QUANT_GRANULARITY;
+
+// A dense layer for inference with its weights held only in the model's precision: exactly one of the
+// weight buffers is allocated, row n feeding neuron n. Biases stay in fp32.
+typedef struct {
+    size_t      num_inputs;
+    size_t      num_neurons;
+    ACTIVATION  activation;
+
+    float       *fp32;
+    uint16_t    *half;
+    int8_t      *int8;
+    float       *scales;        // int8: one for the layer, or one per neuron
+    size_t      num_scales;
+    float       *biases;
+
+    float       input_max_abs;  // Largest input seen by calibration
+    float       input_scale;    // int8: quantize the inputs too and run the int8 GEMM [0: fp32 inputs]
+} QuantLayer;
+
+// Inference copy of a network, read once from the Layer records network_create fills in
+typedef struct {
+    PRECISION   precision;
+    QuantLayer  *layers;
+    size_t      num_layers;
+    size_t      max_width;      // Widest layer input or output, sizes the activation buffers
+} QuantModel;
+
+// Header
+
+uint16_t float_to_bf16(float x);
+float bf16_to_float(uint16_t h);
+uint16_t float_to_fp16(float x);
+float fp16_to_float(uint16_t h);
+uint16_t float_to_half(float x, PRECISION precision);
+float half_to_float(uint16_t h, PRECISION precision);
+uint16_t float_to_half_stochastic(float x, PRECISION precision);
+int8_t float_to_int8(float x, float scale);
+size_t precision_bytes(PRECISION precision);
+
+QuantModel *quant_model_create(Arena *arena, const Layer *layers, size_t num_layers, PRECISION precision, QUANT_GRANULARITY granularity);
+size_t quant_model_bytes(QuantModel *model);
+void _quant_layer_row(QuantLayer *layer, PRECISION precision, size_t neuron, float *row);
+void _quant_layer_forward(QuantLayer *layer, PRECISION precision, const float *inputs, float *outputs, size_t batch_size, bool calibrate);
+void _quant_model_run(QuantModel *model, const float *inputs, float *outputs, size_t batch_size, bool calibrate);
+void quant_model_forward(QuantModel *model, const float *inputs, float *outputs, size_t batch_size);
+void quant_model_calibrate(QuantModel *model, const float *inputs, size_t batch_size);
+
+void layers_round(const Layer *layers, size_t num_layers, PRECISION precision);
+void graph_optimisation_step_reduced(Graph *graph, const Layer *layers, size_t num_layers, PRECISION precision, float learning_rate);
+
+void calibration_run_mnist(QuantModel *model, MNISTData *data, size_t num_samples);
+float accuracy_mnist(QuantModel *model, MNISTData *data);
+
+// Implementation
+
+uint16_t float_to_bf16(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    if ((bits & 0x7fffffff) > 0x7f800000) return (uint16_t) ((bits >> 16) | 0x40); // Keep NaN a NaN
+
+    bits += 0x7fff + ((bits >> 16) & 1); // Round to nearest even
+
+    return (uint16_t) (bits >> 16);
+}
+
+float bf16_to_float(uint16_t h) {
+    uint32_t bits = (uint32_t) h << 16;
+    float x;
+    memcpy(&x, &bits, sizeof(x));
+
+    return x;
+}
+
+uint16_t float_to_fp16(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000) return (uint16_t) (sign | 0x7e00);    // NaN
+    if (magnitude >= 0x477ff000) return (uint16_t) (sign | 0x7c00);   // Rounds past 65504 to infinity
+
+    if (magnitude < 0x38800000) {
+        // Subnormal in fp16: a multiple of 2^-24, rounded to nearest even
+        float f;
+        memcpy(&f, &magnitude, sizeof(f));
+
+        return (uint16_t) (sign | (uint32_t) lrintf(f * 16777216.0f));
+    }
+
+    magnitude += 0xfff + ((magnitude >> 13) & 1);
+
+    return (uint16_t) (sign | ((magnitude - 0x38000000) >> 13));
+}
+
+float fp16_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0) {
+        float x = ldexpf((float) mantissa, -24);
+        return sign ? -x : x;
+    }
+
+    uint32_t bits = exponent == 0x1f
+        ? sign | 0x7f800000 | (mantissa << 13)
+        : sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+    float x;
+    memcpy(&x, &bits, sizeof(x));
+
+    return x;
+}
+
+uint16_t float_to_half(float x, PRECISION precision) {
+    assert(precision == PRECISION_BF16 || precision == PRECISION_FP16);
+
+    return precision == PRECISION_BF16 ? float_to_bf16(x) : float_to_fp16(x);
+}
+
+float half_to_float(uint16_t h, PRECISION precision) {
+    assert(precision == PRECISION_BF16 || precision == PRECISION_FP16);
+
+    return precision == PRECISION_BF16 ? bf16_to_float(h) : fp16_to_float(h);
+}
+
+uint16_t float_to_half_stochastic(float x, PRECISION precision) {
+    // Round up or down with probability proportional to the distance, so that updates smaller than
+    // half an ulp still move the stored weight in expectation
+    uint16_t nearest = float_to_half(x, precision);
+    float nearest_x = half_to_float(nearest, precision);
+
+    if (nearest_x == x || !isfinite(nearest_x)) return nearest;
+
+    // Both formats are sign-magnitude, so the neighbouring magnitude is one code away
+    uint16_t other = fabsf(nearest_x) > fabsf(x) ? nearest - 1 : nearest + 1;
+    float other_x = half_to_float(other, precision);
+    float p_other = (x - nearest_x) / (other_x - nearest_x);
+
+    return rng_uniform(rng_thread()) < p_other ? other : nearest;
+}
+
+int8_t float_to_int8(float x, float scale) {
+    if (scale == 0) return 0;
+
+    float q = rintf(x / scale);
+
+    if (q > INT8_LEVELS) q = INT8_LEVELS;
+    if (q < -INT8_LEVELS) q = -INT8_LEVELS;
+
+    return (int8_t) q;
+}
+
+size_t precision_bytes(PRECISION precision) {
+    switch (precision) {
+        case PRECISION_FP32: return sizeof(float);
+        case PRECISION_BF16:
+        case PRECISION_FP16: return sizeof(uint16_t);
+        case PRECISION_INT8: return sizeof(int8_t);
+    }
+
+    return 0;
+}
+
+QuantModel *quant_model_create(Arena *arena, const Layer *layers, size_t num_layers, PRECISION precision, QUANT_GRANULARITY granularity) {
+    QuantModel *model = (QuantModel *) arena_allocate(arena, sizeof(QuantModel));
+
+    *model = (QuantModel) {
+        .precision = precision,
+        .layers = (QuantLayer *) arena_allocate(arena, sizeof(QuantLayer) * num_layers),
+        .num_layers = num_layers
+    };
+
+    for (size_t l = 0; l < num_layers; l++) {
+        const Layer *source = &layers[l];
+        QuantLayer *layer = &model->layers[l];
+        size_t num_weights = source->num_inputs * source->num_neurons;
+
+        *layer = (QuantLayer) {
+            .num_inputs = source->num_inputs,
+            .num_neurons = source->num_neurons,
+            .activation = source->activation,
+            .biases = (float *) arena_allocate(arena, sizeof(float) * source->num_neurons)
+        };
+
+        model->max_width = source->num_inputs > model->max_width ? source->num_inputs : model->max_width;
+        model->max_width = source->num_neurons > model->max_width ? source->num_neurons : model->max_width;
+
+        for (size_t n = 0; n < source->num_neurons; n++) {
+            layer->biases[n] = source->biases[n]->data;
+        }
+
+        if (precision == PRECISION_FP32) {
+            layer->fp32 = (float *) arena_allocate(arena, sizeof(float) * num_weights);
+
+            for (size_t i = 0; i < num_weights; i++) {
+                layer->fp32[i] = source->weights[i]->data;
+            }
+        }
+        else if (precision == PRECISION_INT8) {
+            layer->num_scales = granularity == QUANT_PER_CHANNEL ? source->num_neurons : 1;
+            layer->scales = (float *) arena_allocate(arena, sizeof(float) * layer->num_scales);
+            layer->int8 = (int8_t *) arena_allocate(arena, sizeof(int8_t) * num_weights);
+
+            // Each scale covers a run of whole rows: all of them per tensor, one per channel
+            size_t run = num_weights / layer->num_scales;
+
+            for (size_t c = 0; c < layer->num_scales; c++) {
+                float max_abs = 0;
+
+                for (size_t i = c * run; i < (c + 1) * run; i++) {
+                    max_abs = fmaxf(max_abs, fabsf(source->weights[i]->data));
+                }
+
+                layer->scales[c] = max_abs / INT8_LEVELS;
+
+                for (size_t i = c * run; i < (c + 1) * run; i++) {
+                    layer->int8[i] = float_to_int8(source->weights[i]->data, layer->scales[c]);
+                }
+            }
+        }
+        else {
+            layer->half = (uint16_t *) arena_allocate(arena, sizeof(uint16_t) * num_weights);
+
+            for (size_t i = 0; i < num_weights; i++) {
+                layer->half[i] = float_to_half(source->weights[i]->data, precision);
+            }
+        }
+    }
+
+    return model;
+}
+
+size_t quant_model_bytes(QuantModel *model) {
+    // Parameter bytes the model holds: weights in its precision, int8 scales and fp32 biases
+    size_t bytes = 0;
+
+    for (size_t l = 0; l < model->num_layers; l++) {
+        QuantLayer *layer = &model->layers[l];
+
+        bytes += layer->num_inputs * layer->num_neurons * precision_bytes(model->precision);
+        bytes += (layer->num_neurons + layer->num_scales) * sizeof(float);
+    }
+
+    return bytes;
+}
+
+void _quant_layer_row(QuantLayer *layer, PRECISION precision, size_t neuron, float *row) {
+    // Widen the weights of one neuron to fp32
+    size_t offset = neuron * layer->num_inputs;
+
+    for (size_t i = 0; i < layer->num_inputs; i++) {
+        if (precision == PRECISION_FP32) row[i] = layer->fp32[offset + i];
+        else if (precision == PRECISION_INT8) row[i] = (float) layer->int8[offset + i] * layer->scales[layer->num_scales > 1 ? neuron : 0];
+        else row[i] = half_to_float(layer->half[offset + i], precision);
+    }
+}
+
+void _quant_layer_forward(QuantLayer *layer, PRECISION precision, const float *inputs, float *outputs, size_t batch_size, bool calibrate) {
+    // inputs[batch_size x num_inputs] -> outputs[batch_size x num_neurons]
+    KernelBackend *backend = kernels();
+    size_t k = layer->num_inputs;
+    size_t m = layer->num_neurons;
+
+    if (calibrate) {
+        for (size_t i = 0; i < batch_size * k; i++) {
+            layer->input_max_abs = fmaxf(layer->input_max_abs, fabsf(inputs[i]));
+        }
+    }
+
+    if (precision == PRECISION_INT8 && layer->input_scale > 0 && !calibrate) {
+        // Integer products accumulate exactly in int32, then each output is rescaled once
+        int8_t *quantized = (int8_t *) calloc(batch_size * k, sizeof(int8_t));
+        int32_t *accumulators = (int32_t *) calloc(batch_size * m, sizeof(int32_t));
+
+        for (size_t i = 0; i < batch_size * k; i++) {
+            quantized[i] = float_to_int8(inputs[i], layer->input_scale);
+        }
+
+        kernels_gemm_s8_nt(batch_size, m, k, quantized, layer->int8, accumulators);
+
+        for (size_t b = 0; b < batch_size; b++) {
+            for (size_t j = 0; j < m; j++) {
+                float scale = layer->input_scale * layer->scales[layer->num_scales > 1 ? j : 0];
+
+                outputs[b * m + j] = (float) accumulators[b * m + j] * scale + layer->biases[j];
+            }
+        }
+
+        free(quantized);
+        quantized = NULL;
+        free(accumulators);
+        accumulators = NULL;
+    }
+    else {
+        // Widen one row at a time, so the fp32 copy never exceeds a single neuron's weights
+        float *row = (float *) calloc(k, sizeof(float));
+
+        for (size_t j = 0; j < m; j++) {
+            const float *weights = layer->fp32 ? layer->fp32 + j * k : row;
+
+            if (!layer->fp32) _quant_layer_row(layer, precision, j, row);
+
+            for (size_t b = 0; b < batch_size; b++) {
+                outputs[b * m + j] = backend->dot(inputs + b * k, weights, k) + layer->biases[j];
+            }
+        }
+
+        free(row);
+        row = NULL;
+    }
+
+    if (layer->activation == ACT_RELU) {
+        backend->relu(outputs, outputs, batch_size * m);
+    }
+    else if (layer->activation == ACT_SIGMOID) {
+        backend->sigmoid(outputs, outputs, batch_size * m);
+    }
+}
+
+void _quant_model_run(QuantModel *model, const float *inputs, float *outputs, size_t batch_size, bool calibrate) {
+    float *buffers[2] = {
+        (float *) calloc(batch_size * model->max_width, sizeof(float)),
+        (float *) calloc(batch_size * model->max_width, sizeof(float))
+    };
+    const float *current = inputs;
+
+    for (size_t l = 0; l < model->num_layers; l++) {
+        bool is_output_layer = l == model->num_layers - 1;
+        float *next = is_output_layer && outputs ? outputs : buffers[l % 2];
+
+        _quant_layer_forward(&model->layers[l], model->precision, current, next, batch_size, calibrate);
+        current = next;
+    }
+
+    free(buffers[0]);
+    buffers[0] = NULL;
+    free(buffers[1]);
+    buffers[1] = NULL;
+}
+
+void quant_model_forward(QuantModel *model, const float *inputs, float *outputs, size_t batch_size) {
+    // inputs[batch_size x num_inputs] -> outputs[batch_size x num_neurons of the last layer]
+    _quant_model_run(model, inputs, outputs, batch_size, false);
+}
+
+void quant_model_calibrate(QuantModel *model, const float *inputs, size_t batch_size) {
+    // Widen each layer's symmetric input range with a batch run in float, then derive the int8 scales.
+    // Only int8 models use them; an uncalibrated int8 model quantizes its weights alone.
+    _quant_model_run(model, inputs, NULL, batch_size, true);
+
+    for (size_t l = 0; l < model->num_layers; l++) {
+        QuantLayer *layer = &model->layers[l];
+
+        layer->input_scale = layer->input_max_abs / INT8_LEVELS;
+    }
+}
+
+void layers_round(const Layer *layers, size_t num_layers, PRECISION precision) {
+    // Round every weight to the nearest value the 16-bit format holds
+    for (size_t l = 0; l < num_layers; l++) {
+        for (size_t i = 0; i < layers[l].num_inputs * layers[l].num_neurons; i++) {
+            Value *weight = layers[l].weights[i];
+
+            weight->data = half_to_float(float_to_half(weight->data, precision), precision);
+        }
+    }
+}
+
+void graph_optimisation_step_reduced(Graph *graph, const Layer *layers, size_t num_layers, PRECISION precision, float learning_rate) {
+    // The weights only ever hold values the 16-bit format can represent: every update is rounded
+    // stochastically back onto that grid, so there is no fp32 master copy to fall back on.
+    // Gradients and biases stay in fp32.
+    assert(precision == PRECISION_BF16 || precision == PRECISION_FP16);
+
+    graph_zero_grad(graph);
+    graph_forward(graph);
+    graph_backward(graph);
+
+    for (size_t l = 0; l < num_layers; l++) {
+        const Layer *layer = &layers[l];
+
+        for (size_t n = 0; n < layer->num_neurons; n++) {
+            layer->biases[n]->data -= layer->biases[n]->grad * learning_rate;
+        }
+
+        for (size_t i = 0; i < layer->num_inputs * layer->num_neurons; i++) {
+            Value *weight = layer->weights[i];
+            uint16_t updated = float_to_half_stochastic(weight->data - weight->grad * learning_rate, precision);
+
+            weight->data = half_to_float(updated, precision);
+        }
+    }
+}
+
+void calibration_run_mnist(QuantModel *model, MNISTData *data, size_t num_samples) {
+    size_t num_pixels = data->num_rows * data->num_cols;
+    float *pixels = (float *) calloc(QUANT_BATCH_SIZE * num_pixels, sizeof(float));
+
+    assert(model->layers[0].num_inputs == num_pixels);
+
+    for (size_t start = 0; start < num_samples; start += QUANT_BATCH_SIZE) {
+        size_t batch_size = num_samples - start < QUANT_BATCH_SIZE ? num_samples - start : QUANT_BATCH_SIZE;
+
+        for (size_t b = 0; b < batch_size; b++) {
+            get_example(data, rng_below(rng_thread(), data->num_items), pixels + b * num_pixels);
+        }
+
+        quant_model_calibrate(model, pixels, batch_size);
+    }
+
+    free(pixels);
+    pixels = NULL;
+}
+
+float accuracy_mnist(QuantModel *model, MNISTData *data) {
+    // Accuracy of a single sigmoid output thresholded at 0.5
+    size_t num_pixels = data->num_rows * data->num_cols;
+    float *pixels = (float *) calloc(QUANT_BATCH_SIZE * num_pixels, sizeof(float));
+    float predictions[QUANT_BATCH_SIZE];
+    size_t num_correct = 0;
+
+    assert(model->layers[model->num_layers - 1].num_neurons == 1);
+
+    for (size_t start = 0; start < data->num_items; start += QUANT_BATCH_SIZE) {
+        size_t batch_size = data->num_items - start < QUANT_BATCH_SIZE ? data->num_items - start : QUANT_BATCH_SIZE;
+
+        for (size_t b = 0; b < batch_size; b++) {
+            get_example(data, start + b, pixels + b * num_pixels);
+        }
+
+        quant_model_forward(model, pixels, predictions, batch_size);
+
+        for (size_t b = 0; b < batch_size; b++) {
+            uint8_t predicted_label = predictions[b] < 0.5 ? 0 : 1;
+            num_correct += predicted_label == data->labels[start + b];
+        }
+    }
+
+    free(pixels);
+    pixels = NULL;
+
+    return (float) num_correct / (float) data->num_items;
+}
+
+#endif // QUANTIZE_H
@@ -0,0 +1,262 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <math.h>
+
+#include "arena.h"
+
+#define RNG_LANES           8
+#define RNG_TWO_PI          6.28318530717958647692f
+
+// xoshiro128** generator. Generators created from the same seed with different stream ids are
+// independent, so every thread or worker can own one without sharing state.
+typedef struct {
+    uint32_t s[4];
+} Rng;
+
+// RNG_LANES interleaved xoshiro128+ generators, laid out so that filling a buffer vectorises
+typedef struct {
+    uint32_t s[4][RNG_LANES];
+} RngBulk;
+
+// Visits every index once per epoch, in a fresh random order each epoch
+typedef struct {
+    size_t  *indices;
+    size_t  num_items;
+    size_t  position;
+    Rng     rng;
+} Sampler;
+
+// Header
+
+uint64_t splitmix64(uint64_t *state);
+Rng rng_create(uint64_t seed, uint64_t stream);
+void rng_set_seed(uint64_t seed);
+void rng_thread_seed(uint64_t seed, uint64_t stream);
+Rng *rng_thread(void);
+uint32_t rng_next(Rng *rng);
+uint64_t rng_next64(Rng *rng);
+float rng_uniform(Rng *rng);
+float rng_normal(Rng *rng);
+uint32_t rng_below(Rng *rng, uint32_t n);
+
+RngBulk rng_bulk_create(Rng *rng);
+void rng_bulk_fill_uniform(RngBulk *bulk, float *out, size_t n, float low, float high);
+void rng_bulk_fill_normal(RngBulk *bulk, float *out, size_t n, float mean, float std);
+
+Sampler *sampler_create(Arena *arena, size_t num_items, Rng *rng);
+void sampler_shuffle(Sampler *sampler);
+size_t sampler_next(Sampler *sampler);
+
+uint32_t _rotl32(uint32_t x, int k);
+
+// Implementation
+
+_Thread_local Rng _rng_thread_state;
+_Thread_local bool _rng_thread_seeded = false;
+
+uint32_t _rotl32(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+    return z ^ (z >> 31);
+}
+
+Rng rng_create(uint64_t seed, uint64_t stream) {
+    uint64_t state = seed ^ splitmix64(&stream);
+    Rng rng;
+
+    uint64_t a = splitmix64(&state);
+    uint64_t b = splitmix64(&state);
+
+    rng.s[0] = (uint32_t) a;
+    rng.s[1] = (uint32_t) (a >> 32);
+    rng.s[2] = (uint32_t) b;
+    rng.s[3] = (uint32_t) (b >> 32);
+
+    if ((rng.s[0] | rng.s[1] | rng.s[2] | rng.s[3]) == 0) rng.s[0] = 1; // The all-zero state is a fixed point
+
+    return rng;
+}
+
+void rng_set_seed(uint64_t seed) {
+    // Seeds the calling thread, normally main, with stream 0
+    rng_thread_seed(seed, 0);
+}
+
+void rng_thread_seed(uint64_t seed, uint64_t stream) {
+    // Every other thread that draws from rng_thread() picks its stream id explicitly, so a run replays the
+    // same numbers whatever order the threads start in
+    _rng_thread_state = rng_create(seed, stream);
+    _rng_thread_seeded = true;
+}
+
+Rng *rng_thread(void) {
+    assert(_rng_thread_seeded && "call rng_set_seed or rng_thread_seed on this thread first");
+
+    return &_rng_thread_state;
+}
+
+uint32_t rng_next(Rng *rng) {
+    uint32_t *s = rng->s;
+    uint32_t result = _rotl32(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = _rotl32(s[3], 11);
+
+    return result;
+}
+
+uint64_t rng_next64(Rng *rng) {
+    // Two draws in a fixed order: the operands of one expression would be evaluated in an unspecified one
+    uint64_t high = rng_next(rng);
+    uint64_t low = rng_next(rng);
+
+    return (high << 32) | low;
+}
+
+float rng_uniform(Rng *rng) {
+    // Top 24 bits, so every value is exactly representable and 1 is never returned
+    return (float) (rng_next(rng) >> 8) * 0x1.0p-24f;
+}
+
+float rng_normal(Rng *rng) {
+    float u1 = 1.0f - rng_uniform(rng);
+    float u2 = rng_uniform(rng);
+
+    return sqrtf(-2.0f * logf(u1)) * cosf(RNG_TWO_PI * u2);
+}
+
+uint32_t rng_below(Rng *rng, uint32_t n) {
+    // Lemire's multiply-shift with rejection, so there is no modulo bias and the result is always < n
+    assert(n > 0);
+
+    uint64_t m = (uint64_t) rng_next(rng) * n;
+    uint32_t low = (uint32_t) m;
+
+    if (low < n) {
+        uint32_t threshold = -n % n;
+
+        while (low < threshold) {
+            m = (uint64_t) rng_next(rng) * n;
+            low = (uint32_t) m;
+        }
+    }
+
+    return (uint32_t) (m >> 32);
+}
+
+RngBulk rng_bulk_create(Rng *rng) {
+    RngBulk bulk;
+
+    for (size_t lane = 0; lane < RNG_LANES; lane++) {
+        Rng lane_rng = rng_create(rng_next64(rng), lane);
+
+        for (size_t i = 0; i < 4; i++) {
+            bulk.s[i][lane] = lane_rng.s[i];
+        }
+    }
+
+    return bulk;
+}
+
+void rng_bulk_fill_uniform(RngBulk *bulk, float *out, size_t n, float low, float high) {
+    float block[RNG_LANES];
+    float range = high - low;
+
+    for (size_t i = 0; i < n; i += RNG_LANES) {
+        // Same xoshiro128+ step in every lane; the compiler turns this loop into SIMD
+        for (size_t lane = 0; lane < RNG_LANES; lane++) {
+            uint32_t result = bulk->s[0][lane] + bulk->s[3][lane];
+            uint32_t t = bulk->s[1][lane] << 9;
+
+            bulk->s[2][lane] ^= bulk->s[0][lane];
+            bulk->s[3][lane] ^= bulk->s[1][lane];
+            bulk->s[1][lane] ^= bulk->s[2][lane];
+            bulk->s[0][lane] ^= bulk->s[3][lane];
+            bulk->s[2][lane] ^= t;
+            bulk->s[3][lane] = (bulk->s[3][lane] << 11) | (bulk->s[3][lane] >> 21);
+
+            block[lane] = low + range * ((float) (result >> 8) * 0x1.0p-24f);
+        }
+
+        size_t count = n - i < RNG_LANES ? n - i : RNG_LANES;
+
+        for (size_t lane = 0; lane < count; lane++) {
+            out[i + lane] = block[lane];
+        }
+    }
+}
+
+void rng_bulk_fill_normal(RngBulk *bulk, float *out, size_t n, float mean, float std) {
+    // Box-Muller over pairs of uniforms; an odd tail borrows one extra uniform
+    float tail[2];
+
+    rng_bulk_fill_uniform(bulk, out, n, 0, 1);
+    rng_bulk_fill_uniform(bulk, tail, 2, 0, 1);
+
+    for (size_t i = 0; i < n; i += 2) {
+        float u1 = 1.0f - out[i];
+        float u2 = i + 1 < n ? out[i + 1] : tail[0];
+        float radius = std * sqrtf(-2.0f * logf(u1));
+
+        out[i] = mean + radius * cosf(RNG_TWO_PI * u2);
+
+        if (i + 1 < n) out[i + 1] = mean + radius * sinf(RNG_TWO_PI * u2);
+    }
+}
+
+Sampler *sampler_create(Arena *arena, size_t num_items, Rng *rng) {
+    // The sampler's own generator is drawn from rng, which is usually rng_thread()
+    Sampler *sampler = (Sampler *) arena_allocate(arena, sizeof(Sampler));
+
+    *sampler = (Sampler) {
+        .num_items = num_items,
+        .rng = rng_create(rng_next64(rng), 0)
+    };
+
+    sampler->indices = (size_t *) arena_allocate(arena, sizeof(size_t) * num_items);
+
+    for (size_t i = 0; i < num_items; i++) {
+        sampler->indices[i] = i;
+    }
+
+    sampler_shuffle(sampler);
+
+    return sampler;
+}
+
+void sampler_shuffle(Sampler *sampler) {
+    // Fisher-Yates
+    for (size_t i = sampler->num_items; i > 1; i--) {
+        size_t j = rng_below(&sampler->rng, (uint32_t) i);
+        size_t tmp = sampler->indices[i - 1];
+
+        sampler->indices[i - 1] = sampler->indices[j];
+        sampler->indices[j] = tmp;
+    }
+
+    sampler->position = 0;
+}
+
+size_t sampler_next(Sampler *sampler) {
+    if (sampler->position == sampler->num_items) sampler_shuffle(sampler);
+
+    return sampler->indices[sampler->position++];
+}
+
+#endif // RANDOM_H
@@ -0,0 +1,266 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "pool.h"
+
+#define SCHEDULE_MIN_PARALLEL       1024    // Smaller levels run inline on the calling thread
+#define SCHEDULE_MIN_CHUNK          256
+#define SCHEDULE_TASKS_PER_WORKER   4
+
+// Splits a graph into wavefronts: every value in a level only depends on values in earlier levels, so
+// a level can run in any order across threads. Backward walks the levels in reverse, and each level is
+// further split into phases whose values share no children, so gradient accumulation never races.
+typedef struct {
+    Value   **forward_values;
+    size_t  *level_offsets;     // level l spans forward_values[level_offsets[l]..level_offsets[l + 1])
+    size_t  num_levels;
+
+    Value   **backward_values;
+    size_t  *phase_offsets;     // phase p spans backward_values[phase_offsets[p]..phase_offsets[p + 1])
+    size_t  num_phases;
+} Schedule;
+
+typedef struct {
+    Value   **values;
+    float   learning_rate;
+} UpdateContext;
+
+// Header
+
+Schedule *schedule_create(Arena *arena, Graph *graph);
+void schedule_forward(Schedule *schedule, ThreadPool *pool);
+void schedule_backward(Graph *graph, Schedule *schedule, ThreadPool *pool);
+void schedule_optimisation_step(Graph *graph, Schedule *schedule, ThreadPool *pool, float learning_rate);
+void schedule_print(Schedule *schedule);
+
+size_t _schedule_chunk(ThreadPool *pool, size_t count);
+void _schedule_forward_task(void *context, size_t begin, size_t end, size_t worker);
+void _schedule_backward_task(void *context, size_t begin, size_t end, size_t worker);
+void _schedule_zero_grad_task(void *context, size_t begin, size_t end, size_t worker);
+void _schedule_update_task(void *context, size_t begin, size_t end, size_t worker);
+
+// Implementation
+
+Schedule *schedule_create(Arena *arena, Graph *graph) {
+    size_t num_values = graph->num_values;
+    ValueMap *index = graph_index_create(graph);
+    size_t *levels = (size_t *) calloc(num_values, sizeof(size_t));
+    size_t num_levels = 1;
+    size_t num_forward = 0;
+
+    // Values come before their children, so walking backwards sees every child first
+    for (size_t i = num_values; i > 0; i--) {
+        Value *value = graph->values[i - 1];
+        size_t level = 0;
+
+        if (value->forward) {
+            for (size_t j = 0; j < value->num_children; j++) {
+                size_t child_level = levels[value_map_find(index, value->children[j])] + 1;
+                level = child_level > level ? child_level : level;
+            }
+
+            num_forward += 1;
+        }
+
+        levels[i - 1] = level;
+        num_levels = level + 1 > num_levels ? level + 1 : num_levels;
+    }
+
+    Schedule *schedule = (Schedule *) arena_allocate(arena, sizeof(Schedule));
+
+    *schedule = (Schedule) {
+        .num_levels = num_levels
+    };
+
+    schedule->forward_values = (Value **) arena_allocate(arena, sizeof(Value *) * (num_forward + 1));
+    schedule->level_offsets = (size_t *) arena_allocate(arena, sizeof(size_t) * (num_levels + 1));
+    schedule->backward_values = (Value **) arena_allocate(arena, sizeof(Value *) * (num_forward + 1));
+    schedule->phase_offsets = (size_t *) arena_allocate(arena, sizeof(size_t) * (num_forward + 2));
+
+    // Counting sort of the computed values by level; leaves sit in level 0 and never run
+    for (size_t l = 0; l <= num_levels; l++) {
+        schedule->level_offsets[l] = 0;
+    }
+
+    for (size_t i = 0; i < num_values; i++) {
+        if (graph->values[i]->forward) schedule->level_offsets[levels[i] + 1] += 1;
+    }
+
+    for (size_t l = 0; l < num_levels; l++) {
+        schedule->level_offsets[l + 1] += schedule->level_offsets[l];
+    }
+
+    size_t *cursor = (size_t *) calloc(num_levels, sizeof(size_t));
+
+    for (size_t l = 0; l < num_levels; l++) {
+        cursor[l] = schedule->level_offsets[l];
+    }
+
+    for (size_t i = num_values; i > 0; i--) {
+        if (graph->values[i - 1]->forward) schedule->forward_values[cursor[levels[i - 1]]++] = graph->values[i - 1];
+    }
+
+    // Greedy colouring of each level: a value joins the current phase if none of its children has been
+    // claimed by another value in that phase, otherwise it waits for the next one. Constants are never
+    // written in backward, and values with grad_in_state (tensor op taps) only write their own slot of the
+    // child's state, so neither is a conflict.
+    size_t *claimed_by = (size_t *) calloc(num_values, sizeof(size_t));
+    Value **remaining = (Value **) calloc(num_forward + 1, sizeof(Value *));
+    size_t num_backward = 0;
+
+    schedule->phase_offsets[0] = 0;
+
+    for (size_t l = num_levels; l > 0; l--) {
+        size_t num_remaining = 0;
+
+        for (size_t i = schedule->level_offsets[l - 1]; i < schedule->level_offsets[l]; i++) {
+            if (schedule->forward_values[i]->backward) remaining[num_remaining++] = schedule->forward_values[i];
+        }
+
+        while (num_remaining > 0) {
+            size_t phase = schedule->num_phases + 1;
+            size_t num_deferred = 0;
+
+            for (size_t i = 0; i < num_remaining; i++) {
+                Value *value = remaining[i];
+                bool conflict = false;
+
+                for (size_t j = 0; j < value->num_children && !conflict && !value->grad_in_state; j++) {
+                    Value *child = value->children[j];
+                    conflict = !value_is_constant(child) && claimed_by[value_map_find(index, child)] == phase;
+                }
+
+                if (conflict) {
+                    remaining[num_deferred++] = value;
+                    continue;
+                }
+
+                for (size_t j = 0; j < value->num_children && !value->grad_in_state; j++) {
+                    if (!value_is_constant(value->children[j])) claimed_by[value_map_find(index, value->children[j])] = phase;
+                }
+
+                schedule->backward_values[num_backward++] = value;
+            }
+
+            schedule->num_phases += 1;
+            schedule->phase_offsets[schedule->num_phases] = num_backward;
+            num_remaining = num_deferred;
+        }
+    }
+
+    free(remaining);
+    remaining = NULL;
+    free(claimed_by);
+    claimed_by = NULL;
+    free(cursor);
+    cursor = NULL;
+    free(levels);
+    levels = NULL;
+    value_map_destroy(index);
+    index = NULL;
+
+    return schedule;
+}
+
+size_t _schedule_chunk(ThreadPool *pool, size_t count) {
+    if (count < SCHEDULE_MIN_PARALLEL) return count;
+
+    size_t chunk = count / (pool->num_workers * SCHEDULE_TASKS_PER_WORKER);
+
+    return chunk > SCHEDULE_MIN_CHUNK ? chunk : SCHEDULE_MIN_CHUNK;
+}
+
+void _schedule_forward_task(void *context, size_t begin, size_t end, size_t worker) {
+    Value **values = (Value **) context;
+
+    for (size_t i = begin; i < end; i++) {
+        values[i]->forward(values[i]);
+    }
+}
+
+void _schedule_backward_task(void *context, size_t begin, size_t end, size_t worker) {
+    Value **values = (Value **) context;
+
+    for (size_t i = begin; i < end; i++) {
+        values[i]->backward(values[i]);
+    }
+}
+
+void _schedule_zero_grad_task(void *context, size_t begin, size_t end, size_t worker) {
+    Value **values = (Value **) context;
+
+    for (size_t i = begin; i < end; i++) {
+        values[i]->grad = 0;
+    }
+}
+
+void _schedule_update_task(void *context, size_t begin, size_t end, size_t worker) {
+    UpdateContext *update = (UpdateContext *) context;
+
+    for (size_t i = begin; i < end; i++) {
+        Value *value = update->values[i];
+
+        if (!value->not_trainable) {
+            value->data -= value->grad * update->learning_rate;
+        }
+    }
+}
+
+void schedule_forward(Schedule *schedule, ThreadPool *pool) {
+    for (size_t l = 1; l < schedule->num_levels; l++) {
+        size_t start = schedule->level_offsets[l];
+        size_t count = schedule->level_offsets[l + 1] - start;
+
+        pool_parallel_for(pool, 0, count, _schedule_chunk(pool, count), _schedule_forward_task, schedule->forward_values + start);
+    }
+}
+
+void schedule_backward(Graph *graph, Schedule *schedule, ThreadPool *pool) {
+    graph->values[0]->grad = 1;
+
+    for (size_t p = 0; p < schedule->num_phases; p++) {
+        size_t start = schedule->phase_offsets[p];
+        size_t count = schedule->phase_offsets[p + 1] - start;
+
+        pool_parallel_for(pool, 0, count, _schedule_chunk(pool, count), _schedule_backward_task, schedule->backward_values + start);
+    }
+}
+
+void schedule_optimisation_step(Graph *graph, Schedule *schedule, ThreadPool *pool, float learning_rate) {
+    assert(graph->num_values > 0);
+
+    size_t chunk = _schedule_chunk(pool, graph->num_values);
+
+    pool_parallel_for(pool, 0, graph->num_values, chunk, _schedule_zero_grad_task, graph->values);
+    schedule_forward(schedule, pool);
+    schedule_backward(graph, schedule, pool);
+
+    UpdateContext update = {
+        .values = graph->values,
+        .learning_rate = learning_rate
+    };
+
+    pool_parallel_for(pool, 0, graph->num_values, chunk, _schedule_update_task, &update);
+}
+
+void schedule_print(Schedule *schedule) {
+    size_t num_forward = schedule->level_offsets[schedule->num_levels];
+    size_t widest = 0;
+
+    for (size_t l = 0; l < schedule->num_levels; l++) {
+        size_t width = schedule->level_offsets[l + 1] - schedule->level_offsets[l];
+        widest = width > widest ? width : widest;
+    }
+
+    printf("===== Schedule(%zu values) =====\n", num_forward);
+    printf("Forward levels: %zu, widest: %zu, average width: %.1f\n", schedule->num_levels - 1, widest, (float) num_forward / (float) (schedule->num_levels - 1));
+    printf("Backward phases: %zu\n", schedule->num_phases);
+    printf("===========================\n");
+}
+
+#endif // SCHEDULE_H
@@ -0,0 +1,608 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "arena.h"
+#include "exec.h"
+#include "micrograd.h"
+#include "pool.h"
+#include "timing.h"
+
+#define SERVER_MAGIC                0x4452474d // "MGRD"
+#define SERVER_POLL_INTERVAL_MS     100
+#define LATENCY_BUCKETS_PER_OCTAVE  4
+#define LATENCY_NUM_BUCKETS         128
+
+typedef enum {
+    REQUEST_INFER,
+    REQUEST_SHUTDOWN
+} REQUEST_TYPE;
+
+typedef enum {
+    STATUS_OK,
+    STATUS_BAD_REQUEST,
+    STATUS_SHUTTING_DOWN    // The server stopped before the request could be queued
+} RESPONSE_STATUS;
+
+// Every message on the socket is this header followed by `num_floats` floats in host byte order
+typedef struct {
+    uint32_t    magic;
+    uint32_t    type;       // REQUEST_TYPE for requests, RESPONSE_STATUS for responses
+    uint32_t    id;
+    uint32_t    num_floats;
+} MessageHeader;
+
+typedef struct {
+    const char  *socket_path;
+    size_t      max_batch_size;
+    uint32_t    max_wait_us;
+    size_t      max_connections;
+    size_t      num_workers;    // Threads sharing each batch; 0 means 1
+} ServerConfig;
+
+typedef struct {
+    uint64_t    counts[LATENCY_NUM_BUCKETS];
+    uint64_t    total;
+} LatencyHistogram;
+
+typedef struct Request Request;
+typedef struct Server Server;
+
+struct Request {
+    float           *inputs;
+    float           *outputs;
+    uint64_t        enqueued_ns;
+    bool            done;
+    pthread_cond_t  *done_cond;
+    Request         *next;
+};
+
+typedef struct {
+    Server          *server;
+    int             fd;
+    bool            in_use;
+    Request         request;
+    pthread_cond_t  done_cond;
+} Connection;
+
+struct Server {
+    ServerConfig        config;
+
+    ExecModel           *model;         // One resident copy of the weights...
+    ExecContext         **contexts;     // ...and one set of activations per worker
+    ThreadPool          *pool;
+    Request             **batch;
+    size_t              num_inputs;
+    size_t              num_outputs;
+
+    int                 listen_fd;
+    bool                running;
+    Connection          *connections;
+    size_t              num_active;
+
+    pthread_t           batcher;
+    pthread_mutex_t     lock;
+    pthread_cond_t      queue_cond;
+    pthread_cond_t      idle_cond;
+    Request             *queue_head;
+    Request             *queue_tail;
+    size_t              queue_size;
+
+    LatencyHistogram    latency;
+    uint64_t            *batch_sizes;   // batch_sizes[n] counts batches that held n requests
+    uint64_t            num_batches;
+};
+
+// Header
+
+size_t latency_bucket(uint64_t us);
+void latency_record(LatencyHistogram *histogram, uint64_t ns);
+void latency_merge(LatencyHistogram *dst, LatencyHistogram *src);
+float latency_percentile(LatencyHistogram *histogram, float percentile);
+
+bool _read_full(int fd, void *buffer, size_t size);
+bool _write_full(int fd, const void *buffer, size_t size);
+bool _write_message(int fd, uint32_t type, uint32_t id, const float *payload, uint32_t num_floats);
+
+Server *server_create(Arena *arena, Graph *graph, Value **inputs, size_t num_inputs, Value **outputs, size_t num_outputs, ServerConfig config);
+void server_run(Server *server);
+void server_stop(Server *server);
+void server_report(Server *server);
+void server_destroy(Server *server);
+void *_server_batcher(void *arg);
+void _server_task(void *context, size_t begin, size_t end, size_t worker);
+void *_server_connection(void *arg);
+bool _server_is_running(Server *server);
+
+int client_connect(const char *socket_path);
+bool client_infer(int fd, uint32_t id, const float *inputs, uint32_t num_inputs, float *outputs, uint32_t num_outputs);
+bool client_shutdown(int fd);
+
+// Implementation
+
+size_t latency_bucket(uint64_t us) {
+    // Bucket 0 holds sub-microsecond samples, then LATENCY_BUCKETS_PER_OCTAVE buckets per power of two
+    if (us == 0) return 0;
+
+    size_t bucket = 1 + (size_t) (log2((double) us) * LATENCY_BUCKETS_PER_OCTAVE);
+
+    return bucket < LATENCY_NUM_BUCKETS ? bucket : LATENCY_NUM_BUCKETS - 1;
+}
+
+void latency_record(LatencyHistogram *histogram, uint64_t ns) {
+    histogram->counts[latency_bucket(ns / 1000)] += 1;
+    histogram->total += 1;
+}
+
+void latency_merge(LatencyHistogram *dst, LatencyHistogram *src) {
+    for (size_t i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+
+    dst->total += src->total;
+}
+
+float latency_percentile(LatencyHistogram *histogram, float percentile) {
+    // Returns the upper bound (in microseconds) of the bucket containing the percentile
+    uint64_t target = (uint64_t) ceilf(percentile * (float) histogram->total);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+
+        if (seen >= target && seen > 0) {
+            return i == 0 ? 1.0f : exp2f((float) i / LATENCY_BUCKETS_PER_OCTAVE);
+        }
+    }
+
+    return 0;
+}
+
+bool _read_full(int fd, void *buffer, size_t size) {
+    char *ptr = (char *) buffer;
+
+    while (size > 0) {
+        ssize_t n = read(fd, ptr, size);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        ptr += n;
+        size -= (size_t) n;
+    }
+
+    return true;
+}
+
+bool _write_full(int fd, const void *buffer, size_t size) {
+    const char *ptr = (const char *) buffer;
+
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+
+        ptr += n;
+        size -= (size_t) n;
+    }
+
+    return true;
+}
+
+bool _write_message(int fd, uint32_t type, uint32_t id, const float *payload, uint32_t num_floats) {
+    MessageHeader header = {
+        .magic = SERVER_MAGIC,
+        .type = type,
+        .id = id,
+        .num_floats = num_floats
+    };
+
+    if (!_write_full(fd, &header, sizeof(header))) return false;
+
+    return num_floats == 0 || _write_full(fd, payload, sizeof(float) * num_floats);
+}
+
+Server *server_create(Arena *arena, Graph *graph, Value **inputs, size_t num_inputs, Value **outputs, size_t num_outputs, ServerConfig config) {
+    assert(config.max_batch_size > 0);
+    assert(config.max_connections > 0);
+
+    Server *server = (Server *) arena_allocate(arena, sizeof(Server));
+    size_t num_workers = config.num_workers > 0 ? config.num_workers : 1;
+
+    *server = (Server) {
+        .config = config,
+        .model = exec_model_create(arena, graph, inputs, num_inputs, outputs, num_outputs),
+        .pool = pool_create(num_workers),
+        .num_inputs = num_inputs,
+        .num_outputs = num_outputs,
+        .listen_fd = -1
+    };
+
+    server->contexts = (ExecContext **) arena_allocate(arena, sizeof(ExecContext *) * num_workers);
+    server->batch = (Request **) arena_allocate(arena, sizeof(Request *) * config.max_batch_size);
+
+    for (size_t w = 0; w < num_workers; w++) {
+        server->contexts[w] = exec_context_create(arena, server->model);
+    }
+
+    server->connections = (Connection *) arena_allocate(arena, sizeof(Connection) * config.max_connections);
+    server->batch_sizes = (uint64_t *) arena_allocate(arena, sizeof(uint64_t) * (config.max_batch_size + 1));
+
+    memset(server->batch_sizes, 0, sizeof(uint64_t) * (config.max_batch_size + 1));
+
+    for (size_t i = 0; i < config.max_connections; i++) {
+        Connection *connection = &server->connections[i];
+
+        *connection = (Connection) {
+            .server = server,
+            .fd = -1
+        };
+
+        connection->request.inputs = (float *) arena_allocate(arena, sizeof(float) * num_inputs);
+        connection->request.outputs = (float *) arena_allocate(arena, sizeof(float) * num_outputs);
+        connection->request.done_cond = &connection->done_cond;
+        pthread_cond_init(&connection->done_cond, NULL);
+    }
+
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->queue_cond, NULL);
+    pthread_cond_init(&server->idle_cond, NULL);
+
+    return server;
+}
+
+void server_run(Server *server) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+    assert(strlen(server->config.socket_path) < sizeof(address.sun_path));
+    strcpy(address.sun_path, server->config.socket_path);
+
+    signal(SIGPIPE, SIG_IGN);
+    unlink(server->config.socket_path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(server->listen_fd >= 0);
+
+    if (bind(server->listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, (int) server->config.max_connections) != 0) {
+        perror("server_run");
+        close(server->listen_fd);
+        return;
+    }
+
+    server->running = true;
+
+    if (pthread_create(&server->batcher, NULL, _server_batcher, server) != 0) {
+        // Without the batcher no request would ever be answered
+        perror("server_run");
+        server->running = false;
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        unlink(server->config.socket_path);
+        return;
+    }
+
+    printf("Serving on %s (max batch size %zu, max wait %u us, %zu workers)\n", server->config.socket_path, server->config.max_batch_size, server->config.max_wait_us, server->pool->num_workers);
+
+    while (_server_is_running(server)) {
+        // Poll so that a shutdown request is noticed without another client connecting
+        struct pollfd pfd = { .fd = server->listen_fd, .events = POLLIN };
+
+        if (poll(&pfd, 1, SERVER_POLL_INTERVAL_MS) <= 0) continue;
+
+        int fd = accept(server->listen_fd, NULL, NULL);
+
+        if (fd < 0) continue;
+
+        pthread_mutex_lock(&server->lock);
+
+        Connection *connection = NULL;
+
+        for (size_t i = 0; i < server->config.max_connections; i++) {
+            if (!server->connections[i].in_use) {
+                connection = &server->connections[i];
+                break;
+            }
+        }
+
+        if (connection) {
+            connection->fd = fd;
+            connection->in_use = true;
+            server->num_active += 1;
+        }
+
+        pthread_mutex_unlock(&server->lock);
+
+        if (!connection) {
+            close(fd);
+            continue;
+        }
+
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, _server_connection, connection) != 0) {
+            // Give the slot back, as the connection thread would have on exit
+            perror("server_run");
+            close(fd);
+
+            pthread_mutex_lock(&server->lock);
+            connection->fd = -1;
+            connection->in_use = false;
+            server->num_active -= 1;
+            pthread_cond_signal(&server->idle_cond);
+            pthread_mutex_unlock(&server->lock);
+
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    // Unblock connection threads waiting on their clients and wait for them to finish
+    pthread_mutex_lock(&server->lock);
+
+    for (size_t i = 0; i < server->config.max_connections; i++) {
+        if (server->connections[i].in_use) {
+            shutdown(server->connections[i].fd, SHUT_RDWR);
+        }
+    }
+
+    while (server->num_active > 0) {
+        pthread_cond_wait(&server->idle_cond, &server->lock);
+    }
+
+    pthread_cond_broadcast(&server->queue_cond);
+    pthread_mutex_unlock(&server->lock);
+
+    pthread_join(server->batcher, NULL);
+
+    close(server->listen_fd);
+    server->listen_fd = -1;
+    unlink(server->config.socket_path);
+}
+
+void server_stop(Server *server) {
+    pthread_mutex_lock(&server->lock);
+    server->running = false;
+    pthread_cond_broadcast(&server->queue_cond);
+    pthread_mutex_unlock(&server->lock);
+}
+
+void server_report(Server *server) {
+    pthread_mutex_lock(&server->lock);
+
+    printf("===== Server(%llu requests, %llu batches) =====\n", (unsigned long long) server->latency.total, (unsigned long long) server->num_batches);
+    printf("Latency p50: %.0f us, p99: %.0f us\n", latency_percentile(&server->latency, 0.5f), latency_percentile(&server->latency, 0.99f));
+    printf("Batch size histogram:\n");
+
+    for (size_t i = 1; i <= server->config.max_batch_size; i++) {
+        if (server->batch_sizes[i] == 0) continue;
+
+        float fraction = (float) server->batch_sizes[i] / (float) server->num_batches;
+
+        printf("%4zu: %8llu (%5.1f%%)\n", i, (unsigned long long) server->batch_sizes[i], 100.0f * fraction);
+    }
+
+    printf("===========================\n");
+
+    pthread_mutex_unlock(&server->lock);
+}
+
+void server_destroy(Server *server) {
+    for (size_t i = 0; i < server->config.max_connections; i++) {
+        pthread_cond_destroy(&server->connections[i].done_cond);
+    }
+
+    pthread_cond_destroy(&server->idle_cond);
+    pthread_cond_destroy(&server->queue_cond);
+    pthread_mutex_destroy(&server->lock);
+
+    pool_destroy(server->pool);
+    server->pool = NULL;
+}
+
+void *_server_batcher(void *arg) {
+    Server *server = (Server *) arg;
+    size_t max_batch_size = server->config.max_batch_size;
+    Request **batch = server->batch;
+
+    pthread_mutex_lock(&server->lock);
+
+    while (true) {
+        while (server->running && server->queue_size == 0) {
+            pthread_cond_wait(&server->queue_cond, &server->lock);
+        }
+
+        if (server->queue_size == 0) break;
+
+        // Coalesce until the batch is full or the oldest request has waited long enough
+        uint64_t deadline_ns = server->queue_head->enqueued_ns + (uint64_t) server->config.max_wait_us * 1000;
+
+        while (server->running && server->queue_size < max_batch_size) {
+            uint64_t now_ns = time_now_ns();
+
+            if (now_ns >= deadline_ns) break;
+
+            struct timespec abstime;
+            clock_gettime(CLOCK_REALTIME, &abstime);
+
+            uint64_t wake_ns = (uint64_t) abstime.tv_nsec + (deadline_ns - now_ns);
+            abstime.tv_sec += (time_t) (wake_ns / 1000000000ull);
+            abstime.tv_nsec = (long) (wake_ns % 1000000000ull);
+
+            pthread_cond_timedwait(&server->queue_cond, &server->lock, &abstime);
+        }
+
+        size_t batch_size = 0;
+
+        while (server->queue_head && batch_size < max_batch_size) {
+            batch[batch_size++] = server->queue_head;
+            server->queue_head = server->queue_head->next;
+            server->queue_size -= 1;
+        }
+
+        if (!server->queue_head) server->queue_tail = NULL;
+
+        pthread_mutex_unlock(&server->lock);
+
+        // Every worker runs its share of the batch in its own context on the one resident model
+        pool_parallel_for(server->pool, 0, batch_size, 1, _server_task, server);
+
+        uint64_t done_ns = time_now_ns();
+
+        pthread_mutex_lock(&server->lock);
+
+        server->batch_sizes[batch_size] += 1;
+        server->num_batches += 1;
+
+        for (size_t i = 0; i < batch_size; i++) {
+            latency_record(&server->latency, done_ns - batch[i]->enqueued_ns);
+            batch[i]->done = true;
+            pthread_cond_signal(batch[i]->done_cond);
+        }
+    }
+
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+void _server_task(void *context, size_t begin, size_t end, size_t worker) {
+    Server *server = (Server *) context;
+    ExecContext *ctx = server->contexts[worker];
+
+    for (size_t i = begin; i < end; i++) {
+        Request *request = server->batch[i];
+
+        exec_forward(ctx, request->inputs);
+
+        for (size_t j = 0; j < server->num_outputs; j++) {
+            request->outputs[j] = exec_output(ctx, j);
+        }
+    }
+}
+
+void *_server_connection(void *arg) {
+    Connection *connection = (Connection *) arg;
+    Server *server = connection->server;
+    Request *request = &connection->request;
+    MessageHeader header;
+
+    while (_read_full(connection->fd, &header, sizeof(header)) && header.magic == SERVER_MAGIC) {
+        if (header.type == REQUEST_SHUTDOWN) {
+            _write_message(connection->fd, STATUS_OK, header.id, NULL, 0);
+            server_stop(server);
+            break;
+        }
+
+        if (header.type != REQUEST_INFER || header.num_floats != server->num_inputs) {
+            _write_message(connection->fd, STATUS_BAD_REQUEST, header.id, NULL, 0);
+            break;
+        }
+
+        if (!_read_full(connection->fd, request->inputs, sizeof(float) * server->num_inputs)) break;
+
+        pthread_mutex_lock(&server->lock);
+
+        // Once stopped, the batcher may already have drained the queue and exited
+        if (!server->running) {
+            pthread_mutex_unlock(&server->lock);
+            _write_message(connection->fd, STATUS_SHUTTING_DOWN, header.id, NULL, 0);
+            break;
+        }
+
+        request->enqueued_ns = time_now_ns();
+        request->done = false;
+        request->next = NULL;
+
+        if (server->queue_tail) server->queue_tail->next = request;
+        else server->queue_head = request;
+
+        server->queue_tail = request;
+        server->queue_size += 1;
+
+        pthread_cond_signal(&server->queue_cond);
+
+        while (!request->done) {
+            pthread_cond_wait(&connection->done_cond, &server->lock);
+        }
+
+        pthread_mutex_unlock(&server->lock);
+
+        if (!_write_message(connection->fd, STATUS_OK, header.id, request->outputs, (uint32_t) server->num_outputs)) break;
+    }
+
+    close(connection->fd);
+
+    pthread_mutex_lock(&server->lock);
+
+    connection->fd = -1;
+    connection->in_use = false;
+    server->num_active -= 1;
+
+    pthread_cond_signal(&server->idle_cond);
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+bool _server_is_running(Server *server) {
+    pthread_mutex_lock(&server->lock);
+    bool running = server->running;
+    pthread_mutex_unlock(&server->lock);
+
+    return running;
+}
+
+int client_connect(const char *socket_path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+
+    assert(strlen(socket_path) < sizeof(address.sun_path));
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) return -1;
+
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool client_infer(int fd, uint32_t id, const float *inputs, uint32_t num_inputs, float *outputs, uint32_t num_outputs) {
+    MessageHeader header;
+
+    if (!_write_message(fd, REQUEST_INFER, id, inputs, num_inputs)) return false;
+    if (!_read_full(fd, &header, sizeof(header))) return false;
+    if (header.magic != SERVER_MAGIC || header.type != STATUS_OK || header.id != id) return false;
+    if (header.num_floats != num_outputs) return false;
+
+    return _read_full(fd, outputs, sizeof(float) * num_outputs);
+}
+
+bool client_shutdown(int fd) {
+    MessageHeader header;
+
+    if (!_write_message(fd, REQUEST_SHUTDOWN, 0, NULL, 0)) return false;
+
+    return _read_full(fd, &header, sizeof(header)) && header.type == STATUS_OK;
+}
+
+#endif // SERVER_H
@@ -0,0 +1,428 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "arena.h"
+#include "micrograd.h"
+#include "mnist.h"
+#include "pool.h"
+#include "random.h"
+#include "timing.h"
+
+typedef enum {
+    TRIAL_PENDING,
+    TRIAL_RUNNING,
+    TRIAL_COMPLETED,
+    TRIAL_STOPPED,      // Worse than the median of the other trials at the same checkpoint
+    TRIAL_DIVERGED      // The validation loss stopped being finite
+} TRIAL_STATUS;
+
+// One point of the sweep: a learning rate and a network for the 0 vs 1 MNIST task
+typedef struct {
+    float           learning_rate;
+    NetworkConfig   network;
+} SweepTrialConfig;
+
+typedef struct {
+    SweepTrialConfig    config;
+    TRIAL_STATUS        status;
+    size_t              steps;
+    size_t              num_checkpoints;
+    size_t              num_values;
+    float               best_loss;      // Validation loss and accuracy at the best checkpoint
+    float               best_accuracy;
+    double              seconds;        // Time spent training and validating
+} SweepTrial;
+
+// The model and data order of a running trial, kept between rounds
+typedef struct {
+    Arena       *arena;
+    Value       **inputs;
+    Value       *y;
+    Value       **outputs;
+    Graph       *graph;
+    Sampler     *sampler;
+    float       *pixels;
+} SweepState;
+
+typedef struct {
+    size_t      max_steps;
+    size_t      eval_interval;      // Training steps between validation checkpoints
+    size_t      num_validation;     // Validation examples per checkpoint; 0 uses all of them
+    size_t      min_checkpoints;    // Checkpoints every trial runs before it can be stopped
+    size_t      arena_size;         // Per trial
+    size_t      max_values;
+    size_t      num_workers;
+    uint64_t    seed;
+} SweepConfig;
+
+// Trials run concurrently on a thread pool, each in its own arena with its own graph. The data is
+// loaded once and only ever read. The sweep advances in rounds: every running trial trains up to its
+// next checkpoint, and once all of them have reported, a trial doing worse than the median of the
+// others at that checkpoint is stopped. Stopping therefore never depends on how trials were scheduled.
+typedef struct {
+    SweepConfig     config;
+    MNISTData       *train;
+    MNISTData       *validation;
+    SweepTrial      *trials;
+    SweepState      *states;
+    size_t          num_trials;
+    float           *checkpoint_losses;     // [trial * max_checkpoints + k], NAN until reported
+    size_t          max_checkpoints;
+    size_t          *running;               // Trials in the current round
+    size_t          num_running;
+    size_t          checkpoint;             // The checkpoint the current round trains up to
+    ThreadPool      *pool;
+} Sweep;
+
+// Header
+
+Sweep *sweep_create(Arena *arena, MNISTData *train, MNISTData *validation, const SweepTrialConfig *trials, size_t num_trials, SweepConfig config);
+void sweep_destroy(Sweep *sweep);
+void sweep_run(Sweep *sweep);
+void sweep_print(Sweep *sweep);
+bool sweep_write(Sweep *sweep, const char *path);
+const char *trial_status_name(TRIAL_STATUS status);
+
+void _sweep_setup_task(void *context, size_t begin, size_t end, size_t worker);
+void _sweep_round_task(void *context, size_t begin, size_t end, size_t worker);
+void _sweep_setup(Sweep *sweep, size_t t);
+void _sweep_round(Sweep *sweep, size_t t);
+void _sweep_finish(Sweep *sweep, size_t t, TRIAL_STATUS status);
+float _sweep_validate(MNISTData *data, size_t num_examples, Graph *graph, Value **inputs, Value *y, Value *y_pred, float *pixels, float *accuracy);
+bool _sweep_should_stop(Sweep *sweep, size_t t, size_t checkpoint);
+size_t *_sweep_ranking(Sweep *sweep);
+void _sweep_layers(SweepTrialConfig *config, char *buffer, size_t size);
+
+// Implementation
+
+Sweep *sweep_create(Arena *arena, MNISTData *train, MNISTData *validation, const SweepTrialConfig *trials, size_t num_trials, SweepConfig config) {
+    assert(config.eval_interval > 0);
+    assert(config.num_workers > 0);
+
+    Sweep *sweep = (Sweep *) arena_allocate(arena, sizeof(Sweep));
+
+    *sweep = (Sweep) {
+        .config = config,
+        .train = train,
+        .validation = validation,
+        .num_trials = num_trials,
+        .max_checkpoints = config.max_steps / config.eval_interval + 1,
+        .pool = pool_create(config.num_workers)
+    };
+
+    if (sweep->config.num_validation == 0 || sweep->config.num_validation > validation->num_items) {
+        sweep->config.num_validation = validation->num_items;
+    }
+
+    sweep->trials = (SweepTrial *) arena_allocate(arena, sizeof(SweepTrial) * num_trials);
+    sweep->states = (SweepState *) arena_allocate(arena, sizeof(SweepState) * num_trials);
+    sweep->running = (size_t *) arena_allocate(arena, sizeof(size_t) * num_trials);
+    sweep->checkpoint_losses = (float *) arena_allocate(arena, sizeof(float) * num_trials * sweep->max_checkpoints);
+
+    for (size_t t = 0; t < num_trials; t++) {
+        sweep->trials[t] = (SweepTrial) {
+            .config = trials[t],
+            .status = TRIAL_PENDING,
+            .best_loss = INFINITY
+        };
+
+        sweep->trials[t].config.network.num_inputs = train->num_rows * train->num_cols;
+    }
+
+    for (size_t i = 0; i < num_trials * sweep->max_checkpoints; i++) {
+        sweep->checkpoint_losses[i] = NAN;
+    }
+
+    return sweep;
+}
+
+void sweep_destroy(Sweep *sweep) {
+    pool_destroy(sweep->pool);
+    sweep->pool = NULL;
+}
+
+const char *trial_status_name(TRIAL_STATUS status) {
+    switch (status) {
+        case TRIAL_PENDING:     return "pending";
+        case TRIAL_RUNNING:     return "running";
+        case TRIAL_COMPLETED:   return "completed";
+        case TRIAL_STOPPED:     return "stopped";
+        case TRIAL_DIVERGED:    return "diverged";
+    }
+
+    return "unknown";
+}
+
+void sweep_run(Sweep *sweep) {
+    // One trial per task, so idle workers steal whole trials. Rounds end when no trial is running.
+    pool_parallel_for(sweep->pool, 0, sweep->num_trials, 1, _sweep_setup_task, sweep);
+
+    for (sweep->checkpoint = 0; sweep->checkpoint < sweep->max_checkpoints; sweep->checkpoint++) {
+        sweep->num_running = 0;
+
+        for (size_t t = 0; t < sweep->num_trials; t++) {
+            if (sweep->trials[t].status == TRIAL_RUNNING) sweep->running[sweep->num_running++] = t;
+        }
+
+        if (sweep->num_running == 0) break;
+
+        pool_parallel_for(sweep->pool, 0, sweep->num_running, 1, _sweep_round_task, sweep);
+
+        // Every running trial has reported this checkpoint, so the decisions only depend on the losses
+        for (size_t i = 0; i < sweep->num_running; i++) {
+            size_t t = sweep->running[i];
+
+            if (!isfinite(sweep->checkpoint_losses[t * sweep->max_checkpoints + sweep->checkpoint])) {
+                _sweep_finish(sweep, t, TRIAL_DIVERGED);
+            }
+            else if (sweep->trials[t].steps == sweep->config.max_steps) {
+                _sweep_finish(sweep, t, TRIAL_COMPLETED);
+            }
+            else if (_sweep_should_stop(sweep, t, sweep->checkpoint)) {
+                _sweep_finish(sweep, t, TRIAL_STOPPED);
+            }
+        }
+    }
+}
+
+void _sweep_setup_task(void *context, size_t begin, size_t end, size_t worker) {
+    (void) worker;
+
+    for (size_t t = begin; t < end; t++) {
+        _sweep_setup((Sweep *) context, t);
+    }
+}
+
+void _sweep_round_task(void *context, size_t begin, size_t end, size_t worker) {
+    (void) worker;
+    Sweep *sweep = (Sweep *) context;
+
+    for (size_t i = begin; i < end; i++) {
+        _sweep_round(sweep, sweep->running[i]);
+    }
+}
+
+float _sweep_validate(MNISTData *data, size_t num_examples, Graph *graph, Value **inputs, Value *y, Value *y_pred, float *pixels, float *accuracy) {
+    size_t input_dim = data->num_rows * data->num_cols;
+    size_t num_correct = 0;
+    double loss = 0;
+
+    for (size_t i = 0; i < num_examples; i++) {
+        get_example(data, i, pixels);
+
+        for (size_t j = 0; j < input_dim; j++) {
+            inputs[j]->data = pixels[j];
+        }
+
+        y->data = (float) data->labels[i];
+
+        graph_forward(graph);
+
+        loss += graph->values[0]->data;
+        num_correct += (y_pred->data > 0.5f) == (data->labels[i] == 1) ? 1 : 0;
+    }
+
+    *accuracy = (float) num_correct / (float) num_examples;
+
+    return (float) (loss / (double) num_examples);
+}
+
+bool _sweep_should_stop(Sweep *sweep, size_t t, size_t checkpoint) {
+    // Median stopping rule over every other trial that reached this checkpoint without diverging
+    float *others = (float *) calloc(sweep->num_trials, sizeof(float));
+    float best_loss = sweep->checkpoint_losses[t * sweep->max_checkpoints + checkpoint];
+    size_t num_others = 0;
+    bool stop = false;
+
+    for (size_t other = 0; other < sweep->num_trials; other++) {
+        float loss = sweep->checkpoint_losses[other * sweep->max_checkpoints + checkpoint];
+        if (other != t && isfinite(loss)) others[num_others++] = loss;
+    }
+
+    // Insertion sort; there are only as many values as trials
+    for (size_t i = 1; i < num_others; i++) {
+        float key = others[i];
+        size_t j = i;
+
+        for (; j > 0 && others[j - 1] > key; j--) {
+            others[j] = others[j - 1];
+        }
+
+        others[j] = key;
+    }
+
+    if (checkpoint + 1 >= sweep->config.min_checkpoints && num_others >= 2) {
+        float median = num_others % 2 ? others[num_others / 2] : 0.5f * (others[num_others / 2 - 1] + others[num_others / 2]);
+        stop = best_loss > median;
+    }
+
+    free(others);
+    others = NULL;
+
+    return stop;
+}
+
+void _sweep_setup(Sweep *sweep, size_t t) {
+    SweepTrial *trial = &sweep->trials[t];
+    SweepState *state = &sweep->states[t];
+    SweepConfig *config = &sweep->config;
+    size_t input_dim = sweep->train->num_rows * sweep->train->num_cols;
+    double start = time_now_seconds();
+
+    // Every trial initialises from its own stream, so results do not depend on which worker runs it, and
+    // the worker's own generator is left alone
+    Rng rng = rng_create(config->seed, t + 1);
+    NetworkConfig network = trial->config.network;
+
+    network.rng = &rng;
+
+    state->arena = arena_create(config->arena_size);
+    state->inputs = inputs_create(state->arena, input_dim);
+    state->y = value_create_constant(state->arena, 0);
+    state->outputs = network_create(state->arena, state->inputs, network);
+    state->graph = graph_create(state->arena, loss_mean_squared_error(state->arena, state->y, state->outputs[0]), config->max_values);
+    state->sampler = sampler_create(state->arena, sweep->train->num_items, &rng);
+    state->pixels = (float *) arena_allocate(state->arena, sizeof(float) * input_dim);
+
+    trial->num_values = state->graph->num_values;
+    trial->status = TRIAL_RUNNING;
+    trial->seconds = time_now_seconds() - start;
+}
+
+void _sweep_round(Sweep *sweep, size_t t) {
+    // Trains up to the next checkpoint and records the best validation loss so far, or infinity once the
+    // validation loss is no longer finite
+    SweepTrial *trial = &sweep->trials[t];
+    SweepState *state = &sweep->states[t];
+    SweepConfig *config = &sweep->config;
+    size_t input_dim = sweep->train->num_rows * sweep->train->num_cols;
+    double start = time_now_seconds();
+
+    while (trial->steps < config->max_steps) {
+        size_t index = sampler_next(state->sampler);
+
+        get_example(sweep->train, index, state->pixels);
+
+        for (size_t j = 0; j < input_dim; j++) {
+            state->inputs[j]->data = state->pixels[j];
+        }
+
+        state->y->data = (float) sweep->train->labels[index];
+
+        graph_optimisation_step(state->graph, trial->config.learning_rate);
+        trial->steps += 1;
+
+        if (trial->steps % config->eval_interval == 0) break;
+    }
+
+    float accuracy;
+    float validation_loss = _sweep_validate(sweep->validation, config->num_validation, state->graph, state->inputs, state->y, state->outputs[0], state->pixels, &accuracy);
+
+    if (validation_loss < trial->best_loss) {
+        trial->best_loss = validation_loss;
+        trial->best_accuracy = accuracy;
+    }
+
+    trial->num_checkpoints = sweep->checkpoint + 1;
+    trial->seconds += time_now_seconds() - start;
+    sweep->checkpoint_losses[t * sweep->max_checkpoints + sweep->checkpoint] = isfinite(validation_loss) ? trial->best_loss : INFINITY;
+}
+
+void _sweep_finish(Sweep *sweep, size_t t, TRIAL_STATUS status) {
+    // Called between rounds in trial order, so the log is the same on every run
+    SweepTrial *trial = &sweep->trials[t];
+
+    arena_destroy(sweep->states[t].arena);
+    sweep->states[t].arena = NULL;
+
+    trial->status = status;
+
+    printf("Trial %3zu: %-9s after %6zu steps, best validation loss %.5f\n", t, trial_status_name(status), trial->steps, trial->best_loss);
+}
+
+size_t *_sweep_ranking(Sweep *sweep) {
+    // Trial indices ordered by best validation loss; the caller frees the array
+    size_t *order = (size_t *) calloc(sweep->num_trials, sizeof(size_t));
+
+    for (size_t i = 0; i < sweep->num_trials; i++) {
+        size_t j = i;
+
+        for (; j > 0 && sweep->trials[order[j - 1]].best_loss > sweep->trials[i].best_loss; j--) {
+            order[j] = order[j - 1];
+        }
+
+        order[j] = i;
+    }
+
+    return order;
+}
+
+void _sweep_layers(SweepTrialConfig *config, char *buffer, size_t size) {
+    size_t length = (size_t) snprintf(buffer, size, "%zu", config->network.num_inputs);
+
+    for (size_t l = 0; l < config->network.num_layers && length < size; l++) {
+        length += (size_t) snprintf(buffer + length, size - length, "-%zu", config->network.num_neurons[l]);
+    }
+}
+
+void sweep_print(Sweep *sweep) {
+    size_t *order = _sweep_ranking(sweep);
+    char layers[128];
+
+    printf("===== Sweep(%zu trials) =====\n", sweep->num_trials);
+    printf("%4s %10s %-16s %-9s %7s %10s %9s %8s\n", "rank", "lr", "layers", "status", "steps", "val loss", "val acc", "seconds");
+
+    for (size_t r = 0; r < sweep->num_trials; r++) {
+        SweepTrial *trial = &sweep->trials[order[r]];
+
+        _sweep_layers(&trial->config, layers, sizeof(layers));
+
+        printf("%4zu %10.5f %-16s %-9s %7zu %10.5f %9.4f %8.2f\n", r + 1, trial->config.learning_rate, layers,
+            trial_status_name(trial->status), trial->steps, trial->best_loss, trial->best_accuracy, trial->seconds);
+    }
+
+    printf("===========================\n");
+
+    free(order);
+    order = NULL;
+}
+
+bool sweep_write(Sweep *sweep, const char *path) {
+    // Tab separated, best trial first
+    FILE *file = fopen(path, "w");
+
+    if (!file) return false;
+
+    size_t *order = _sweep_ranking(sweep);
+    const char *activations[] = { "linear", "relu", "sigmoid", "softmax" };
+    const char *initializers[] = { "uniform", "xavier", "he" };
+    char layers[128];
+
+    fprintf(file, "rank\ttrial\tlearning_rate\tlayers\thidden_activation\tinitializer\tstatus\tsteps\tcheckpoints\tnum_values\tval_loss\tval_accuracy\tseconds\n");
+
+    for (size_t r = 0; r < sweep->num_trials; r++) {
+        SweepTrial *trial = &sweep->trials[order[r]];
+
+        _sweep_layers(&trial->config, layers, sizeof(layers));
+
+        fprintf(file, "%zu\t%zu\t%g\t%s\t%s\t%s\t%s\t%zu\t%zu\t%zu\t%.6f\t%.4f\t%.3f\n", r + 1, order[r], trial->config.learning_rate, layers,
+            activations[trial->config.network.hidden_activation], initializers[trial->config.network.initializer], trial_status_name(trial->status),
+            trial->steps, trial->num_checkpoints, trial->num_values, trial->best_loss, trial->best_accuracy, trial->seconds);
+    }
+
+    fclose(file);
+
+    free(order);
+    order = NULL;
+
+    return true;
+}
+
+#endif // SWEEP_H
@@ -0,0 +1,426 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "timing.h"
+
+#define TELEMETRY_MAX_THREADS           64
+#define TELEMETRY_MAX_ARENAS            8
+#define TELEMETRY_BUCKETS_PER_OCTAVE    4
+#define TELEMETRY_NUM_BUCKETS           128     // Step times from under 1 us to about 2^31 us
+#define TELEMETRY_CACHE_LINE            64
+#define TELEMETRY_THREAD_CACHE          8       // Shards each thread remembers, one slot per telemetry id modulo this
+
+typedef enum {
+    TELEMETRY_PROMETHEUS,   // Text exposition format, replaced on every write (for a textfile collector)
+    TELEMETRY_JSON          // One JSON object per line, appended on every write
+} TELEMETRY_FORMAT;
+
+typedef struct {
+    const char          *path;
+    TELEMETRY_FORMAT    format;
+    uint32_t            interval_ms;
+} TelemetryConfig;
+
+// The counters of one training thread. Only that thread writes them, so an update is a relaxed load
+// and store rather than a locked read-modify-write, and the writer thread can read them at any time.
+typedef struct {
+    _Alignas(TELEMETRY_CACHE_LINE) atomic_uint_fast64_t steps;
+    atomic_uint_fast64_t    samples;
+    atomic_uint_fast64_t    step_ns;        // Time in forward, backward and update
+    atomic_uint_fast64_t    data_ns;        // Time spent waiting for the next example
+    _Atomic double          loss_sum;
+    atomic_uint_fast64_t    buckets[TELEMETRY_NUM_BUCKETS];
+} TelemetryShard;
+
+// Everything the writer thread derives from the shards at one point in time
+typedef struct {
+    double      seconds;
+    uint64_t    steps;
+    uint64_t    samples;
+    uint64_t    step_ns;
+    uint64_t    data_ns;
+    double      loss_sum;
+    uint64_t    buckets[TELEMETRY_NUM_BUCKETS];
+    uint64_t    thread_steps[TELEMETRY_MAX_THREADS];
+    size_t      num_threads;
+} TelemetrySnapshot;
+
+typedef struct {
+    TelemetryConfig     config;
+    uint64_t            id;             // Unique per telemetry, so a thread never reuses a stale shard
+    TelemetryShard      *shards;
+    atomic_size_t       num_shards;
+    pthread_t           owners[TELEMETRY_MAX_THREADS];     // The thread of each claimed shard, under the lock
+
+    const char          *arena_names[TELEMETRY_MAX_ARENAS];
+    Arena               *arenas[TELEMETRY_MAX_ARENAS];
+    size_t              num_arenas;
+
+    uint64_t            start_ns;
+    TelemetrySnapshot   previous;       // Rates and the interval loss are measured against the last write
+    size_t              num_writes;
+
+    pthread_t           writer;
+    pthread_mutex_t     lock;
+    pthread_cond_t      wake_cond;
+    bool                running;
+} Telemetry;
+
+// Header
+
+Telemetry *telemetry_create(TelemetryConfig config);
+void telemetry_destroy(Telemetry *telemetry);
+void telemetry_watch_arena(Telemetry *telemetry, const char *name, Arena *arena);
+void telemetry_step(Telemetry *telemetry, size_t num_samples, float loss, uint64_t data_ns, uint64_t step_ns);
+void telemetry_flush(Telemetry *telemetry);
+
+TelemetryShard *_telemetry_shard(Telemetry *telemetry);
+void _telemetry_add(atomic_uint_fast64_t *counter, uint64_t amount);
+size_t _telemetry_bucket(uint64_t us);
+double _telemetry_bucket_bound(size_t bucket);
+double _telemetry_percentile(const uint64_t *buckets, uint64_t total, double percentile);
+void _telemetry_collect(Telemetry *telemetry, TelemetrySnapshot *snapshot);
+void _telemetry_write_prometheus(Telemetry *telemetry, FILE *file, TelemetrySnapshot *now);
+void _telemetry_write_json(Telemetry *telemetry, FILE *file, TelemetrySnapshot *now);
+void *_telemetry_writer(void *arg);
+
+// Implementation
+
+atomic_uint_fast64_t _telemetry_next_id = 1;
+_Thread_local uint64_t _telemetry_cached_ids[TELEMETRY_THREAD_CACHE];
+_Thread_local TelemetryShard *_telemetry_cached_shards[TELEMETRY_THREAD_CACHE];
+
+Telemetry *telemetry_create(TelemetryConfig config) {
+    assert(config.path);
+    assert(config.interval_ms > 0);
+
+    Telemetry *telemetry = (Telemetry *) calloc(1, sizeof(Telemetry));
+
+    telemetry->config = config;
+    telemetry->id = atomic_fetch_add(&_telemetry_next_id, 1);
+    telemetry->shards = (TelemetryShard *) aligned_alloc(TELEMETRY_CACHE_LINE, sizeof(TelemetryShard) * TELEMETRY_MAX_THREADS);
+    telemetry->start_ns = time_now_ns();
+    telemetry->running = true;
+
+    memset(telemetry->shards, 0, sizeof(TelemetryShard) * TELEMETRY_MAX_THREADS);
+    atomic_init(&telemetry->num_shards, 0);
+
+    // JSON lines accumulate over the run, so start from an empty file
+    if (config.format == TELEMETRY_JSON) {
+        FILE *file = fopen(config.path, "w");
+        if (file) fclose(file);
+    }
+
+    pthread_mutex_init(&telemetry->lock, NULL);
+    pthread_cond_init(&telemetry->wake_cond, NULL);
+    pthread_create(&telemetry->writer, NULL, _telemetry_writer, telemetry);
+
+    return telemetry;
+}
+
+void telemetry_destroy(Telemetry *telemetry) {
+    // Stops the writer, which writes once more so the file ends with the final totals
+    pthread_mutex_lock(&telemetry->lock);
+    telemetry->running = false;
+    pthread_cond_signal(&telemetry->wake_cond);
+    pthread_mutex_unlock(&telemetry->lock);
+
+    pthread_join(telemetry->writer, NULL);
+
+    pthread_cond_destroy(&telemetry->wake_cond);
+    pthread_mutex_destroy(&telemetry->lock);
+
+    free(telemetry->shards);
+    telemetry->shards = NULL;
+    free(telemetry);
+    telemetry = NULL;
+}
+
+void telemetry_watch_arena(Telemetry *telemetry, const char *name, Arena *arena) {
+    // Reported as used and total bytes. Arenas are read without locking, so the value is approximate
+    // if the arena is allocating while it is written.
+    pthread_mutex_lock(&telemetry->lock);
+
+    assert(telemetry->num_arenas < TELEMETRY_MAX_ARENAS);
+
+    telemetry->arena_names[telemetry->num_arenas] = name;
+    telemetry->arenas[telemetry->num_arenas++] = arena;
+
+    pthread_mutex_unlock(&telemetry->lock);
+}
+
+TelemetryShard *_telemetry_shard(Telemetry *telemetry) {
+    // Each thread claims one shard per telemetry the first time it reports and keeps it for the rest of
+    // the run. The thread-local cache makes the common case lock free; on a miss (a new telemetry, or
+    // another one evicting the slot) the thread finds its shard again by owner before claiming a new one.
+    size_t slot = telemetry->id % TELEMETRY_THREAD_CACHE;
+
+    if (_telemetry_cached_ids[slot] == telemetry->id) return _telemetry_cached_shards[slot];
+
+    pthread_mutex_lock(&telemetry->lock);
+
+    size_t num_shards = atomic_load(&telemetry->num_shards);
+    size_t index = 0;
+
+    while (index < num_shards && !pthread_equal(telemetry->owners[index], pthread_self())) {
+        index++;
+    }
+
+    if (index == num_shards) {
+        assert(index < TELEMETRY_MAX_THREADS);
+
+        telemetry->owners[index] = pthread_self();
+        atomic_store(&telemetry->num_shards, index + 1);
+    }
+
+    pthread_mutex_unlock(&telemetry->lock);
+
+    _telemetry_cached_ids[slot] = telemetry->id;
+    _telemetry_cached_shards[slot] = &telemetry->shards[index];
+
+    return _telemetry_cached_shards[slot];
+}
+
+void _telemetry_add(atomic_uint_fast64_t *counter, uint64_t amount) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+size_t _telemetry_bucket(uint64_t us) {
+    // Bucket 0 holds sub-microsecond steps, then TELEMETRY_BUCKETS_PER_OCTAVE buckets per power of two
+    if (us == 0) return 0;
+
+    size_t bucket = 1 + (size_t) (log2((double) us) * TELEMETRY_BUCKETS_PER_OCTAVE);
+
+    return bucket < TELEMETRY_NUM_BUCKETS ? bucket : TELEMETRY_NUM_BUCKETS - 1;
+}
+
+double _telemetry_bucket_bound(size_t bucket) {
+    // Upper bound of the bucket in seconds
+    return exp2((double) bucket / TELEMETRY_BUCKETS_PER_OCTAVE) / 1e6;
+}
+
+void telemetry_step(Telemetry *telemetry, size_t num_samples, float loss, uint64_t data_ns, uint64_t step_ns) {
+    // Called by the trainer once per optimisation step, with the time it waited for data and the time
+    // the step itself took. The reported loss is the mean of `loss` over the steps of an interval.
+    TelemetryShard *shard = _telemetry_shard(telemetry);
+
+    _telemetry_add(&shard->steps, 1);
+    _telemetry_add(&shard->samples, num_samples);
+    _telemetry_add(&shard->step_ns, step_ns);
+    _telemetry_add(&shard->data_ns, data_ns);
+    _telemetry_add(&shard->buckets[_telemetry_bucket(step_ns / 1000)], 1);
+
+    atomic_store_explicit(&shard->loss_sum, atomic_load_explicit(&shard->loss_sum, memory_order_relaxed) + loss, memory_order_relaxed);
+}
+
+void _telemetry_collect(Telemetry *telemetry, TelemetrySnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(TelemetrySnapshot));
+
+    snapshot->seconds = (double) (time_now_ns() - telemetry->start_ns) / 1e9;
+    snapshot->num_threads = atomic_load(&telemetry->num_shards);
+    snapshot->num_threads = snapshot->num_threads < TELEMETRY_MAX_THREADS ? snapshot->num_threads : TELEMETRY_MAX_THREADS;
+
+    for (size_t t = 0; t < snapshot->num_threads; t++) {
+        TelemetryShard *shard = &telemetry->shards[t];
+
+        snapshot->thread_steps[t] = atomic_load_explicit(&shard->steps, memory_order_relaxed);
+        snapshot->steps += snapshot->thread_steps[t];
+        snapshot->samples += atomic_load_explicit(&shard->samples, memory_order_relaxed);
+        snapshot->step_ns += atomic_load_explicit(&shard->step_ns, memory_order_relaxed);
+        snapshot->data_ns += atomic_load_explicit(&shard->data_ns, memory_order_relaxed);
+        snapshot->loss_sum += atomic_load_explicit(&shard->loss_sum, memory_order_relaxed);
+
+        for (size_t b = 0; b < TELEMETRY_NUM_BUCKETS; b++) {
+            snapshot->buckets[b] += atomic_load_explicit(&shard->buckets[b], memory_order_relaxed);
+        }
+    }
+}
+
+double _telemetry_percentile(const uint64_t *buckets, uint64_t total, double percentile) {
+    // The upper bound (in seconds) of the bucket containing the percentile
+    uint64_t target = (uint64_t) ceil(percentile * (double) total);
+    uint64_t seen = 0;
+
+    for (size_t b = 0; b < TELEMETRY_NUM_BUCKETS; b++) {
+        seen += buckets[b];
+
+        if (seen >= target && seen > 0) return _telemetry_bucket_bound(b);
+    }
+
+    return 0;
+}
+
+void _telemetry_write_prometheus(Telemetry *telemetry, FILE *file, TelemetrySnapshot *now) {
+    TelemetrySnapshot *previous = &telemetry->previous;
+    double elapsed = now->seconds - previous->seconds;
+    uint64_t interval_steps = now->steps - previous->steps;
+
+    fprintf(file, "# HELP micrograd_steps_total Optimisation steps\n# TYPE micrograd_steps_total counter\n");
+    fprintf(file, "micrograd_steps_total %llu\n", (unsigned long long) now->steps);
+    fprintf(file, "# HELP micrograd_samples_total Training examples processed\n# TYPE micrograd_samples_total counter\n");
+    fprintf(file, "micrograd_samples_total %llu\n", (unsigned long long) now->samples);
+    fprintf(file, "# HELP micrograd_samples_per_second Throughput since the previous write\n# TYPE micrograd_samples_per_second gauge\n");
+    fprintf(file, "micrograd_samples_per_second %.3f\n", elapsed > 0 ? (double) (now->samples - previous->samples) / elapsed : 0);
+    fprintf(file, "# HELP micrograd_loss Mean loss per step since the previous write\n# TYPE micrograd_loss gauge\n");
+    fprintf(file, "micrograd_loss %.6g\n", interval_steps > 0 ? (now->loss_sum - previous->loss_sum) / (double) interval_steps : NAN);
+    fprintf(file, "# HELP micrograd_compute_seconds_total Time spent in optimisation steps\n# TYPE micrograd_compute_seconds_total counter\n");
+    fprintf(file, "micrograd_compute_seconds_total %.6f\n", (double) now->step_ns / 1e9);
+    fprintf(file, "# HELP micrograd_data_wait_seconds_total Time spent waiting for examples\n# TYPE micrograd_data_wait_seconds_total counter\n");
+    fprintf(file, "micrograd_data_wait_seconds_total %.6f\n", (double) now->data_ns / 1e9);
+
+    // One fixed boundary per octave keeps the series small and stable across writes
+    uint64_t cumulative = 0;
+
+    fprintf(file, "# HELP micrograd_step_seconds Optimisation step time\n# TYPE micrograd_step_seconds histogram\n");
+
+    for (size_t b = 0; b < TELEMETRY_NUM_BUCKETS; b++) {
+        cumulative += now->buckets[b];
+
+        if (b % TELEMETRY_BUCKETS_PER_OCTAVE == 0) {
+            fprintf(file, "micrograd_step_seconds_bucket{le=\"%g\"} %llu\n", _telemetry_bucket_bound(b), (unsigned long long) cumulative);
+        }
+    }
+
+    fprintf(file, "micrograd_step_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long) now->steps);
+    fprintf(file, "micrograd_step_seconds_sum %.6f\n", (double) now->step_ns / 1e9);
+    fprintf(file, "micrograd_step_seconds_count %llu\n", (unsigned long long) now->steps);
+
+    fprintf(file, "# HELP micrograd_thread_steps_total Optimisation steps per training thread\n# TYPE micrograd_thread_steps_total counter\n");
+
+    for (size_t t = 0; t < now->num_threads; t++) {
+        fprintf(file, "micrograd_thread_steps_total{thread=\"%zu\"} %llu\n", t, (unsigned long long) now->thread_steps[t]);
+    }
+
+    fprintf(file, "# HELP micrograd_arena_used_bytes Bytes allocated from an arena\n# TYPE micrograd_arena_used_bytes gauge\n");
+
+    for (size_t a = 0; a < telemetry->num_arenas; a++) {
+        fprintf(file, "micrograd_arena_used_bytes{arena=\"%s\"} %zu\n", telemetry->arena_names[a], telemetry->arenas[a]->position);
+    }
+
+    fprintf(file, "# HELP micrograd_arena_size_bytes Capacity of an arena\n# TYPE micrograd_arena_size_bytes gauge\n");
+
+    for (size_t a = 0; a < telemetry->num_arenas; a++) {
+        fprintf(file, "micrograd_arena_size_bytes{arena=\"%s\"} %zu\n", telemetry->arena_names[a], telemetry->arenas[a]->size);
+    }
+
+    fprintf(file, "# HELP micrograd_uptime_seconds Time since telemetry started\n# TYPE micrograd_uptime_seconds gauge\n");
+    fprintf(file, "micrograd_uptime_seconds %.3f\n", now->seconds);
+}
+
+void _telemetry_write_json(Telemetry *telemetry, FILE *file, TelemetrySnapshot *now) {
+    TelemetrySnapshot *previous = &telemetry->previous;
+    double elapsed = now->seconds - previous->seconds;
+    uint64_t interval_steps = now->steps - previous->steps;
+    uint64_t interval_buckets[TELEMETRY_NUM_BUCKETS];
+    uint64_t interval_waited = now->data_ns - previous->data_ns;
+    uint64_t interval_busy = interval_waited + now->step_ns - previous->step_ns;
+
+    // Percentiles cover the last interval only, so a slowdown shows up as soon as it happens
+    for (size_t b = 0; b < TELEMETRY_NUM_BUCKETS; b++) {
+        interval_buckets[b] = now->buckets[b] - previous->buckets[b];
+    }
+
+    fprintf(file, "{\"time\": %.3f, \"steps\": %llu, \"samples\": %llu", now->seconds, (unsigned long long) now->steps, (unsigned long long) now->samples);
+    fprintf(file, ", \"samples_per_second\": %.3f", elapsed > 0 ? (double) (now->samples - previous->samples) / elapsed : 0);
+
+    if (interval_steps > 0) {
+        fprintf(file, ", \"loss\": %.6g", (now->loss_sum - previous->loss_sum) / (double) interval_steps);
+        fprintf(file, ", \"step_us_p50\": %.1f, \"step_us_p90\": %.1f, \"step_us_p99\": %.1f",
+            1e6 * _telemetry_percentile(interval_buckets, interval_steps, 0.5),
+            1e6 * _telemetry_percentile(interval_buckets, interval_steps, 0.9),
+            1e6 * _telemetry_percentile(interval_buckets, interval_steps, 0.99));
+    }
+
+    fprintf(file, ", \"data_wait_fraction\": %.4f", interval_busy > 0 ? (double) interval_waited / (double) interval_busy : 0);
+    fprintf(file, ", \"thread_steps\": [");
+
+    for (size_t t = 0; t < now->num_threads; t++) {
+        fprintf(file, "%s%llu", t > 0 ? ", " : "", (unsigned long long) (now->thread_steps[t] - previous->thread_steps[t]));
+    }
+
+    fprintf(file, "], \"arena_used_bytes\": {");
+
+    for (size_t a = 0; a < telemetry->num_arenas; a++) {
+        fprintf(file, "%s\"%s\": %zu", a > 0 ? ", " : "", telemetry->arena_names[a], telemetry->arenas[a]->position);
+    }
+
+    fprintf(file, "}}\n");
+}
+
+void telemetry_flush(Telemetry *telemetry) {
+    // Writes the current totals now; the writer thread calls this every interval
+    pthread_mutex_lock(&telemetry->lock);
+
+    TelemetrySnapshot now;
+    _telemetry_collect(telemetry, &now);
+
+    if (telemetry->config.format == TELEMETRY_JSON) {
+        FILE *file = fopen(telemetry->config.path, "a");
+
+        if (file) {
+            _telemetry_write_json(telemetry, file, &now);
+            fclose(file);
+        }
+    }
+    else {
+        // Write a temporary file and rename it, so a scraper never reads a half-written file
+        char temporary_path[4096];
+        snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", telemetry->config.path);
+
+        FILE *file = fopen(temporary_path, "w");
+
+        if (file) {
+            _telemetry_write_prometheus(telemetry, file, &now);
+            fclose(file);
+            rename(temporary_path, telemetry->config.path);
+        }
+    }
+
+    telemetry->previous = now;
+    telemetry->num_writes += 1;
+
+    pthread_mutex_unlock(&telemetry->lock);
+}
+
+void *_telemetry_writer(void *arg) {
+    Telemetry *telemetry = (Telemetry *) arg;
+
+    pthread_mutex_lock(&telemetry->lock);
+
+    while (telemetry->running) {
+        // pthread_cond_timedwait takes a wall clock deadline; only the wait uses it, never a duration
+        struct timespec deadline;
+        timespec_get(&deadline, TIME_UTC);
+
+        uint64_t wake_ns = (uint64_t) deadline.tv_nsec + (uint64_t) telemetry->config.interval_ms * 1000000ull;
+        deadline.tv_sec += (time_t) (wake_ns / 1000000000ull);
+        deadline.tv_nsec = (long) (wake_ns % 1000000000ull);
+
+        int status = 0;
+
+        while (telemetry->running && status != ETIMEDOUT) {
+            status = pthread_cond_timedwait(&telemetry->wake_cond, &telemetry->lock, &deadline);
+        }
+
+        pthread_mutex_unlock(&telemetry->lock);
+        telemetry_flush(telemetry);
+        pthread_mutex_lock(&telemetry->lock);
+    }
+
+    pthread_mutex_unlock(&telemetry->lock);
+
+    return NULL;
+}
+
+#endif // TELEMETRY_H
@@ -0,0 +1,29 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Durations are measured on the monotonic clock: the wall clock can be stepped (by NTP, or by hand) in
+// the middle of a run, and a difference of two readings would then be meaningless or wrap around.
+// clock_gettime is POSIX, so programs define _POSIX_C_SOURCE before their first include.
+
+// Header
+
+uint64_t time_now_ns(void);
+double time_now_seconds(void);
+
+// Implementation
+
+uint64_t time_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+double time_now_seconds(void) {
+    return (double) time_now_ns() / 1e9;
+}
+
+#endif // TIMING_H